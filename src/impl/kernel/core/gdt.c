@@ -0,0 +1,74 @@
+#include "include/gdt.h"
+#include "include/smp.h"
+#include <stdint.h>
+
+// Null, kernel code/data, user code32/data/code, and the two-slot TSS descriptor
+#define GDT_ENTRIES 8
+
+struct __attribute__((packed)) tss {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+};
+
+struct __attribute__((packed)) gdtr {
+    uint16_t limit;
+    uint64_t base;
+};
+
+// Each CPU needs its own TSS, and a busy TSS descriptor cannot be shared,
+// so every CPU gets a whole GDT.
+static uint64_t gdt[MAX_CPUS][GDT_ENTRIES] __attribute__((aligned(16)));
+static struct tss tss[MAX_CPUS] __attribute__((aligned(16)));
+
+void gdt_set_kernel_stack(uint32_t cpu, uint64_t kernel_stack) {
+    if (cpu < MAX_CPUS) tss[cpu].rsp[0] = kernel_stack;
+}
+
+void gdt_init_cpu(uint32_t cpu, uint64_t kernel_stack) {
+    if (cpu >= MAX_CPUS) return;
+    uint64_t *g = gdt[cpu];
+    struct tss *t = &tss[cpu];
+
+    for (int i = 0; i < (int)sizeof(*t); i++) ((uint8_t *)t)[i] = 0;
+    t->rsp[0] = kernel_stack;
+    t->iomap_base = sizeof(*t); // No I/O permission bitmap
+
+    g[0] = 0;
+    g[GDT_KERNEL_CODE / 8] = 0x00AF9A000000FFFFULL; // 64-bit, DPL 0
+    g[GDT_KERNEL_DATA / 8] = 0x00CF92000000FFFFULL;
+    g[GDT_USER_CODE32 / 8] = 0x00CFFA000000FFFFULL;
+    g[GDT_USER_DATA / 8]   = 0x00CFF2000000FFFFULL;
+    g[GDT_USER_CODE / 8]   = 0x00AFFA000000FFFFULL; // 64-bit, DPL 3
+
+    // 64-bit available TSS (type 9), present
+    uint64_t base = (uint64_t)t;
+    uint64_t limit = sizeof(*t) - 1;
+    g[GDT_TSS / 8] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) | (0x89ULL << 40) |
+                     (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+    g[GDT_TSS / 8 + 1] = base >> 32;
+
+    struct gdtr gdtr = { sizeof(gdt[cpu]) - 1, (uint64_t)g };
+
+    // Reload CS with a far return, then the data segments and the task
+    // register. FS and GS are left alone: the GS base is the per-CPU pointer.
+    __asm__ volatile(
+        "lgdt %0\n"
+        "pushq %1\n"
+        "leaq 1f(%%rip), %%rax\n"
+        "pushq %%rax\n"
+        "lretq\n"
+        "1:\n"
+        "mov %2, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%ss\n"
+        "mov %3, %%ax\n"
+        "ltr %%ax\n"
+        : : "m"(gdtr), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA), "i"(GDT_TSS)
+        : "rax", "memory");
+}
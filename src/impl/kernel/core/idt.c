@@ -1,9 +1,16 @@
 #include <stdint.h>
 #include "include/idt.h"
+#include "include/smp.h"
+#include "include/lapic.h"
+#include "include/irq.h"
 
 extern void isr_default_handler();
 extern void isr_irq0();
 extern void isr_irq1();
+extern void isr_ipi_resched();
+extern void isr_ipi_tlb();
+extern void isr_spurious();
+extern void isr_lapic_timer();
 
 // IDT entry structure (packed)
 struct __attribute__((packed)) idt_entry {
@@ -56,8 +63,8 @@ static void pic_remap(void) {
     outb(PIC1_CMD, 0x11);
     outb(PIC2_CMD, 0x11);
     // ICW2 - remap offset
-    outb(PIC1_DATA, 0x20); // Master PIC vector offset
-    outb(PIC2_DATA, 0x28); // Slave PIC vector offset
+    outb(PIC1_DATA, IRQ_VECTOR_BASE);     // Master PIC vector offset
+    outb(PIC2_DATA, IRQ_VECTOR_BASE + 8); // Slave PIC vector offset
     // ICW3 - tell Master about Slave at IRQ2 (0000 0100)
     outb(PIC1_DATA, 0x04);
     // ICW3 - tell Slave its cascade identity (0000 0010)
@@ -74,8 +81,20 @@ static void pic_remap(void) {
 void init_idt(void) {
     for (int i = 0; i < 256; i++) set_idt_entry(i, isr_default_handler);
     /* Set IRQ0 and IRQ1 to our stubs (vectors 32 and 33) */
-    set_idt_entry(32 + 0, isr_irq0);
-    set_idt_entry(32 + 1, isr_irq1);
+    set_idt_entry(IRQ_VECTOR_BASE + 0, isr_irq0);
+    set_idt_entry(IRQ_VECTOR_BASE + 1, isr_irq1);
+    // Masked 8259 lines can still raise a spurious IRQ 7 or 15
+    set_idt_entry(IRQ_VECTOR_BASE + 7, isr_spurious);
+    set_idt_entry(IRQ_VECTOR_BASE + 15, isr_spurious);
+    set_idt_entry(IPI_RESCHED_VECTOR, isr_ipi_resched);
+    set_idt_entry(IPI_TLB_VECTOR, isr_ipi_tlb);
+    set_idt_entry(LAPIC_TIMER_VECTOR, isr_lapic_timer);
+    set_idt_entry(LAPIC_SPURIOUS_VECTOR, isr_spurious);
     pic_remap();
     lidt(idt);
 }
+
+// APs share the BSP's table
+void idt_load(void) {
+    lidt(idt);
+}
@@ -1,10 +1,48 @@
 #include "include/irq.h"
 #include "include/ps2.h"
+#include "include/percpu.h"
+#include "include/io.h"
+#include "include/lapic.h"
+#include "include/ioapic.h"
+#include "include/sched.h"
+#include "include/spinlock.h"
+
+// Forward declaration for kprintf
+extern void kprintf(const char *format, uint32_t color, ...);
 
 // Timer handler (defined in timer.c)
 extern void timer_irq_handler(void);
 
+// 8259 ports
+#define PIC1_CMD  0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD  0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI   0x20
+
+// IRQ 2 is the cascade from the slave PIC, never a device
+#define IRQ_CASCADE 2
+
+// Set by irq_init once the I/O APIC delivers the ISA IRQs
+static int use_ioapic = 0;
+static uint32_t isa_gsi[16];
+
+// Acknowledge at the local APIC, or (for the PICs) at the master and, for
+// slave IRQs, the slave too
+static void irq_eoi(int irq) {
+    if (use_ioapic) {
+        lapic_eoi();
+        return;
+    }
+    if (irq >= 8) outb(PIC2_CMD, PIC_EOI);
+    outb(PIC1_CMD, PIC_EOI);
+}
+
+// Legacy ISA interrupts. Handlers here should only acknowledge the device
+// and capture what cannot wait; anything slower belongs in a work item
+// (workqueue.h) so interrupts are not held off while it runs.
 void irq_handler(int irq) {
+    percpu_inc(nr_irqs);
     switch (irq) {
         case 0:
             // Timer interrupt
@@ -17,4 +55,58 @@ void irq_handler(int irq) {
         default:
             break;
     }
+    irq_eoi(irq);
+}
+
+void irq_init(void) {
+    if (ioapic_init() < 0) return;
+
+    uint64_t flags = local_irq_save();
+    uint16_t pic_mask = inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+    // The PICs stay remapped, so a spurious IRQ 7/15 still lands on a
+    // harmless vector, but no longer deliver anything
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+
+    uint32_t bsp = lapic_id();
+    for (int irq = 0; irq < 16; irq++) {
+        if (irq == IRQ_CASCADE) continue;
+        int level, active_low;
+        isa_gsi[irq] = ioapic_isa_to_gsi(irq, &level, &active_low);
+        int masked = (pic_mask >> irq) & 1;
+        ioapic_route(isa_gsi[irq], IRQ_VECTOR_BASE + irq, bsp, level, active_low, masked);
+    }
+    use_ioapic = 1;
+    local_irq_restore(flags);
+
+    kprintf("IRQ: ISA interrupts moved from the 8259 to the I/O APIC\n", 0x00FF0000);
+}
+
+void irq_mask(int irq) {
+    if (irq < 0 || irq >= 16) return;
+    if (use_ioapic) {
+        ioapic_set_masked(isa_gsi[irq], 1);
+    } else if (irq < 8) {
+        outb(PIC1_DATA, inb(PIC1_DATA) | (1 << irq));
+    } else {
+        outb(PIC2_DATA, inb(PIC2_DATA) | (1 << (irq - 8)));
+    }
+}
+
+void irq_unmask(int irq) {
+    if (irq < 0 || irq >= 16) return;
+    if (use_ioapic) {
+        ioapic_set_masked(isa_gsi[irq], 0);
+    } else if (irq < 8) {
+        outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+    } else {
+        outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+    }
+}
+
+int irq_set_affinity(int irq, uint32_t cpu) {
+    if (!use_ioapic || irq < 0 || irq >= 16 || irq == IRQ_CASCADE) return -1;
+    cpu_info_t *info = sched_get_cpu(cpu);
+    if (!info || !info->online) return -1;
+    return ioapic_set_dest(isa_gsi[irq], info->apic_id);
 }
@@ -0,0 +1,203 @@
+#include "include/ktimer.h"
+#include "include/timer.h"
+#include "include/smp.h"
+#include "include/spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Wheel geometry. A timer due within 64 units of the wheel's clock sits in
+// level 0, in the slot for its exact unit; one due within 64^2 units in
+// level 1, in the slot for its 64-unit block, and so on. When the clock
+// reaches the start of a block, that block's slot is cascaded: its timers
+// move down a level (or several) with their now shorter distance.
+#define WHEEL_SHIFT   10
+#define WHEEL_BITS    6
+#define WHEEL_SIZE    (1 << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS  5
+#define WHEEL_RANGE   (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+
+struct timer_wheel {
+    spinlock_t lock;
+    uint64_t clk;                       // Next unit to process
+    uint64_t pending[WHEEL_LEVELS];     // Non-empty slots of each level
+    ktimer_t *slots[WHEEL_LEVELS][WHEEL_SIZE];
+    uint32_t count;
+    ktimer_t *running;                  // Timer whose callback is running
+};
+
+static struct timer_wheel wheels[MAX_CPUS];
+
+static void wheel_link(struct timer_wheel *w, ktimer_t *t, int level, int index) {
+    ktimer_t **head = &w->slots[level][index];
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    t->slot = (uint16_t)(level * WHEEL_SIZE + index);
+    w->pending[level] |= 1ULL << index;
+}
+
+static void wheel_unlink(struct timer_wheel *w, ktimer_t *t) {
+    int level = t->slot / WHEEL_SIZE;
+    int index = t->slot % WHEEL_SIZE;
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    if (!w->slots[level][index]) w->pending[level] &= ~(1ULL << index);
+}
+
+// Place t by its distance from the wheel's clock. Timers beyond the top
+// level's range park at its far end and are placed again when cascaded.
+static void wheel_insert(struct timer_wheel *w, ktimer_t *t) {
+    uint64_t key = t->expires;
+    if (key < w->clk) key = w->clk;
+    if (key - w->clk >= WHEEL_RANGE) key = w->clk + WHEEL_RANGE - 1;
+    uint64_t delta = key - w->clk;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1)))) level++;
+    wheel_link(w, t, level, (key >> (WHEEL_BITS * level)) & WHEEL_MASK);
+}
+
+// Detach and return the whole list of one slot
+static ktimer_t *wheel_take(struct timer_wheel *w, int level, int index) {
+    ktimer_t *list = w->slots[level][index];
+    w->slots[level][index] = NULL;
+    w->pending[level] &= ~(1ULL << index);
+    return list;
+}
+
+static void wheel_cascade(struct timer_wheel *w, int level) {
+    ktimer_t *t = wheel_take(w, level, (w->clk >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    while (t) {
+        ktimer_t *next = t->next;
+        wheel_insert(w, t);
+        t = next;
+    }
+}
+
+// Distance from slot `index` to the first non-empty slot at or after it
+static int slot_distance(uint64_t pending, int index) {
+    uint64_t rotated = (pending >> index) | (index ? pending << (WHEEL_SIZE - index) : 0);
+    return __builtin_ctzll(rotated);
+}
+
+// Earliest unit anything on the wheel can be due: the exact unit for
+// level 0, the next cascade of a non-empty slot for the levels above.
+// ~0 if the wheel is empty.
+static uint64_t wheel_next_event(struct timer_wheel *w) {
+    uint64_t next = ~0ULL;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (!w->pending[level]) continue;
+        // First block that starts at or after the clock; the slots from
+        // there on cascade once each over the next 64 blocks
+        int shift = WHEEL_BITS * level;
+        uint64_t start = (w->clk + (1ULL << shift) - 1) >> shift;
+        uint64_t due = (start + slot_distance(w->pending[level], start & WHEEL_MASK)) << shift;
+        if (due < next) next = due;
+    }
+    return next;
+}
+
+static uint64_t units_to_us(uint64_t units) {
+    return ((units << WHEEL_SHIFT) + 999) / 1000;
+}
+
+void timer_add(ktimer_t *timer, uint64_t expiry_ns) {
+    timer_cancel(timer);
+
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = smp_processor_id();
+    struct timer_wheel *w = &wheels[cpu];
+    spin_lock(&w->lock);
+
+    // An empty wheel may be far behind; nothing is lost by catching it up
+    uint64_t now = timer_get_uptime_ns() >> WHEEL_SHIFT;
+    if (w->count == 0 && w->clk < now) w->clk = now;
+
+    timer->expires = (expiry_ns + (1ULL << WHEEL_SHIFT) - 1) >> WHEEL_SHIFT;
+    wheel_insert(w, timer);
+    w->count++;
+    __atomic_store_n(&timer->cpu, (int32_t)cpu, __ATOMIC_RELEASE);
+    uint64_t next = wheel_next_event(w);
+    spin_unlock(&w->lock);
+
+    timer_request_wakeup(units_to_us(next));
+    local_irq_restore(flags);
+}
+
+int timer_cancel(ktimer_t *timer) {
+    for (;;) {
+        int32_t cpu = __atomic_load_n(&timer->cpu, __ATOMIC_ACQUIRE);
+        if (cpu < 0) return 0;
+        struct timer_wheel *w = &wheels[cpu];
+        uint64_t flags = spin_lock_irqsave(&w->lock);
+        // It may have fired or moved while we took the lock
+        if (timer->cpu == cpu) {
+            wheel_unlink(w, timer);
+            w->count--;
+            __atomic_store_n(&timer->cpu, -1, __ATOMIC_RELEASE);
+            spin_unlock_irqrestore(&w->lock, flags);
+            return 1;
+        }
+        spin_unlock_irqrestore(&w->lock, flags);
+    }
+}
+
+int timer_cancel_sync(ktimer_t *timer) {
+    int pending = timer_cancel(timer);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        while (__atomic_load_n(&wheels[cpu].running, __ATOMIC_ACQUIRE) == timer) {
+            __asm__ volatile("pause");
+        }
+    }
+    return pending;
+}
+
+void timer_wheel_run(uint64_t now_ns) {
+    struct timer_wheel *w = &wheels[smp_processor_id()];
+    uint64_t now = now_ns >> WHEEL_SHIFT;
+
+    spin_lock(&w->lock);
+    while (w->clk <= now) {
+        // Jump over units with nothing due and no cascade to do
+        uint64_t next = wheel_next_event(w);
+        if (next > now) {
+            w->clk = now + 1;
+            break;
+        }
+        if (next > w->clk) w->clk = next;
+
+        // At each block boundary, cascade the level above; at a boundary
+        // of that level too, the next one up as well
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            if ((w->clk >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK) break;
+            wheel_cascade(w, level);
+        }
+
+        ktimer_t *expired = wheel_take(w, 0, w->clk & WHEEL_MASK);
+        w->clk++;
+        if (!expired) continue;
+
+        // The batch stays linked from here while the callbacks run one at
+        // a time, so timer_cancel can still take the later ones off it
+        expired->pprev = &expired;
+        while (expired) {
+            ktimer_t *t = expired;
+            wheel_unlink(w, t);
+            w->count--;
+            w->running = t;
+            __atomic_store_n(&t->cpu, -1, __ATOMIC_RELEASE);
+            spin_unlock(&w->lock);
+            t->fn(t);
+            spin_lock(&w->lock);
+            __atomic_store_n(&w->running, NULL, __ATOMIC_RELEASE);
+        }
+    }
+    uint64_t next = wheel_next_event(w);
+    spin_unlock(&w->lock);
+
+    if (next != ~0ULL) timer_request_wakeup(units_to_us(next));
+}
@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include "include/mm.h"
 #include "include/stdio.h"
+#include "include/smp.h"
+#include "include/spinlock.h"
 #include <stddef.h>
 
 // Forward declaration for kprintf
@@ -28,17 +30,18 @@ struct multiboot_tag_mmap {
 #define PAGE_SIZE 4096
 
 // The virtual address offset where all of physical memory is mapped.
-// This is a fundamental architectural decision. The bootloader must set up
-// page tables that map all physical memory to this offset before jumping to the kernel.
 // For example, physical address 0x1000 is accessible at virtual 0xFFFF800000001000.
+// The boot page tables map the first 4 GiB here (PML4[256] shares the
+// identity map's PDPT); mm_init gives the direct map its own PDPT and
+// extends it over every usable region above that.
 #define DIRECT_MAP_OFFSET 0xFFFF800000000000
+#define BOOT_MAPPED_LIMIT 0x100000000ULL
+
+// End of the highest range covered by the direct map
+static uint64_t direct_map_end = BOOT_MAPPED_LIMIT;
 
-// TEMPORARY FIX for real hardware: Use identity mapping
-// The bootloader only sets up identity mapping (virt == phys) for first 4GB.
-// Higher-half mapping will be added in Phase 2.
-// TODO: Set up proper higher-half mapping in boot/main.asm
 void* phys_to_virt(uint64_t paddr) { 
-    return (void*)paddr;  // Identity mapping for now
+    return (void*)(paddr + DIRECT_MAP_OFFSET);
 }
 
 // Custom memset
@@ -49,55 +52,457 @@ static void *custom_memset(void *s, int c, size_t n) {
 }
 
 // --- Physical Frame Allocator (PFA) ---
-// A simple stack-based allocator. Assumes we have enough space in .bss
-// to hold the stack for all available memory.
-#define MAX_PAGES (1024*1024*2) // Support up to 8GB of RAM
-static uint64_t page_stack[MAX_PAGES];
-static int64_t page_stack_top = -1;
+// A binary buddy allocator. Free blocks of 2^order pages sit on per-order
+// doubly linked lists threaded through the free pages themselves, so the
+// only other metadata is one byte per frame recording the order of the block
+// that starts there and whether it is free. That array is sized from the
+// memory map and carved out of usable RAM at boot.
+#define PAGE_SHIFT       12
+
+#define FRAME_FREE       0x80 // Set on the first frame of a free block
+#define FRAME_CACHED     0x40 // Single frame held in a magazine or zero pool
+#define FRAME_ORDER_MASK 0x1F
+
+struct pfa_free_block {
+    struct pfa_free_block *next;
+    struct pfa_free_block *prev;
+};
+
+// Memory zones. DMA32 holds the frames below 4 GiB, which page tables and
+// devices limited to 32-bit addresses need; Normal holds everything above.
+// Each zone has its own buddy free lists, so a low allocation never has to
+// search past high memory. No buddy block crosses the 4 GiB line because
+// blocks are naturally aligned and at most 16 MiB.
+#define ZONE_DMA32       0
+#define ZONE_NORMAL      1
+#define NR_ZONES         2
+#define ZONE_DMA32_LIMIT 0x100000000ULL
+
+struct pfa_zone {
+    const char *name;
+    struct pfa_free_block *free_area[PFA_MAX_ORDER + 1];
+    uint64_t free_pages;
+    uint64_t managed_pages;
+};
+
+// Zones to try for a request, most preferred first. Normal requests fall
+// back to DMA32 only once high memory runs out; DMA32 never falls back.
+static const int zone_fallback[NR_ZONES][NR_ZONES + 1] = {
+    [ZONE_DMA32]  = { ZONE_DMA32, -1 },
+    [ZONE_NORMAL] = { ZONE_NORMAL, ZONE_DMA32, -1 },
+};
+
+// Protects the zone free lists and frame_meta
+static spinlock_t pfa_lock = SPINLOCK_INIT;
+static struct pfa_zone zones[NR_ZONES] = {
+    [ZONE_DMA32]  = { .name = "DMA32" },
+    [ZONE_NORMAL] = { .name = "Normal" },
+};
+static uint8_t *frame_meta;       // One byte per frame below pfa_limit
+static uint64_t pfa_limit = 0;    // End of managed physical memory
 static int64_t total_pages_added = 0;  // Track total pages for memory stats
 
-// Separate low memory stack for page table allocations (<4GB, identity mapped)
-#define MAX_LOW_PAGES 4096
-static uint64_t low_page_stack[MAX_LOW_PAGES];
-static int64_t low_page_stack_top = -1;
+static inline int zone_index(uint64_t paddr) {
+    return paddr < ZONE_DMA32_LIMIT ? ZONE_DMA32 : ZONE_NORMAL;
+}
+
+static void free_list_push(struct pfa_zone *zone, uint32_t order, uint64_t paddr) {
+    struct pfa_free_block *block = phys_to_virt(paddr);
+    block->prev = NULL;
+    block->next = zone->free_area[order];
+    if (block->next) block->next->prev = block;
+    zone->free_area[order] = block;
+    frame_meta[paddr >> PAGE_SHIFT] = FRAME_FREE | order;
+}
+
+static void free_list_remove(struct pfa_zone *zone, uint32_t order, struct pfa_free_block *block) {
+    if (block->prev) block->prev->next = block->next;
+    else zone->free_area[order] = block->next;
+    if (block->next) block->next->prev = block->prev;
+}
+
+uint32_t pfa_order_for_size(size_t size) {
+    uint32_t order = 0;
+    while (((size_t)PAGE_SIZE << order) < size) order++;
+    return order;
+}
+
+// Buddy operations; callers hold pfa_lock
+static uint64_t buddy_alloc(struct pfa_zone *zone, uint32_t order) {
+    if (order > PFA_MAX_ORDER) return 0;
+
+    // Find the smallest non-empty list that can satisfy the request
+    uint32_t current = order;
+    while (current <= PFA_MAX_ORDER && !zone->free_area[current]) current++;
+    if (current > PFA_MAX_ORDER) return 0; // Zone exhausted
+
+    struct pfa_free_block *block = zone->free_area[current];
+    free_list_remove(zone, current, block);
+    uint64_t paddr = virt_to_phys(block);
+
+    // Split down to the requested size, returning upper halves to the lists
+    while (current > order) {
+        current--;
+        free_list_push(zone, current, paddr + ((uint64_t)PAGE_SIZE << current));
+    }
+
+    frame_meta[paddr >> PAGE_SHIFT] = order;
+    zone->free_pages -= 1ULL << order;
+    return paddr;
+}
+
+static void buddy_free(uint64_t paddr, uint32_t order) {
+    if (order > PFA_MAX_ORDER) return;
+    if (paddr & (((uint64_t)PAGE_SIZE << order) - 1)) return; // Misaligned
+    uint64_t pfn = paddr >> PAGE_SHIFT;
+    if (paddr >= pfa_limit) return;
+    if (frame_meta[pfn] & (FRAME_FREE | FRAME_CACHED)) {
+        kprintf("MM: double free of frame 0x%lx ignored\n", 0xFF0000, paddr);
+        return;
+    }
+
+    struct pfa_zone *zone = &zones[zone_index(paddr)];
+    zone->free_pages += 1ULL << order;
+    frame_meta[pfn] = 0;
+
+    // Coalesce with the buddy for as long as it is free and of the same size
+    while (order < PFA_MAX_ORDER) {
+        uint64_t buddy_pfn = pfn ^ (1ULL << order);
+        if ((buddy_pfn << PAGE_SHIFT) >= pfa_limit || frame_meta[buddy_pfn] != (FRAME_FREE | order)) break;
+        free_list_remove(zone, order, phys_to_virt(buddy_pfn << PAGE_SHIFT));
+        frame_meta[buddy_pfn] = 0;
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+
+    free_list_push(zone, order, pfn << PAGE_SHIFT);
+}
+
+// --- Per-CPU frame magazines ---
+// Single frames are served from a small per-CPU, per-zone stack, so the
+// common pfa_alloc/pfa_free path only touches CPU-local state with
+// interrupts disabled. Magazines refill from and drain to the buddy lists
+// PCP_BATCH frames at a time, which is the only point where pfa_lock is taken.
+// Each magazine's lock is only ever contended by pcp_drain_all, when an
+// allocation is about to fail. Cached frames are FRAME_CACHED in
+// frame_meta, so freeing one again is caught.
+#define PCP_CAPACITY 64
+#define PCP_BATCH    32
+
+struct pcp_magazine {
+    spinlock_t lock;
+    uint32_t count;
+    uint64_t frames[PCP_CAPACITY]; // Hottest frame on top
+    uint64_t refills;
+    uint64_t drains;
+} __attribute__((aligned(64)));
+
+static struct pcp_magazine pcp_magazines[MAX_CPUS][NR_ZONES];
+
+static void pcp_refill(struct pcp_magazine *mag, struct pfa_zone *zone) {
+    spin_lock(&pfa_lock);
+    while (mag->count < PCP_BATCH) {
+        uint64_t paddr = buddy_alloc(zone, 0);
+        if (!paddr) break;
+        frame_meta[paddr >> PAGE_SHIFT] = FRAME_CACHED;
+        mag->frames[mag->count++] = paddr;
+    }
+    spin_unlock(&pfa_lock);
+    mag->refills++;
+}
+
+static void pcp_drain(struct pcp_magazine *mag, uint32_t n) {
+    if (n > mag->count) n = mag->count;
+
+    // Give back the coldest frames from the bottom of the stack
+    spin_lock(&pfa_lock);
+    for (uint32_t i = 0; i < n; i++) {
+        frame_meta[mag->frames[i] >> PAGE_SHIFT] = 0;
+        buddy_free(mag->frames[i], 0);
+    }
+    spin_unlock(&pfa_lock);
+
+    for (uint32_t i = n; i < mag->count; i++) mag->frames[i - n] = mag->frames[i];
+    mag->count -= n;
+    mag->drains++;
+}
+
+// Pop a frame from a magazine, refilling it from its zone when empty.
+// Called with interrupts disabled.
+static uint64_t pcp_take(struct pcp_magazine *mag, int zone) {
+    spin_lock(&mag->lock);
+    if (mag->count == 0 && zones[zone].free_pages) pcp_refill(mag, &zones[zone]);
+    uint64_t paddr = mag->count ? mag->frames[--mag->count] : 0;
+    if (paddr) frame_meta[paddr >> PAGE_SHIFT] = 0;
+    spin_unlock(&mag->lock);
+    return paddr;
+}
+
+// Return every CPU's cached frames to the buddy lists, where they can be
+// allocated and coalesced again. Returns the number of frames returned.
+static uint64_t pcp_drain_all(void) {
+    uint64_t drained = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        for (int z = 0; z < NR_ZONES; z++) {
+            struct pcp_magazine *mag = &pcp_magazines[cpu][z];
+            if (!__atomic_load_n(&mag->count, __ATOMIC_RELAXED)) continue;
+            uint64_t flags = spin_lock_irqsave(&mag->lock);
+            drained += mag->count;
+            pcp_drain(mag, mag->count);
+            spin_unlock_irqrestore(&mag->lock, flags);
+        }
+    }
+    return drained;
+}
+
+// Allocate 2^order frames from the first zone in the fallback list that has them
+static uint64_t zone_try_alloc(int preferred, uint32_t order) {
+    const int *zl = zone_fallback[preferred];
+    uint64_t paddr = 0;
+
+    if (order == 0) {
+        uint64_t flags = local_irq_save();
+        struct pcp_magazine *mags = pcp_magazines[smp_processor_id()];
+        for (int i = 0; zl[i] >= 0 && !paddr; i++) paddr = pcp_take(&mags[zl[i]], zl[i]);
+        local_irq_restore(flags);
+        return paddr;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&pfa_lock);
+    for (int i = 0; zl[i] >= 0 && !paddr; i++) paddr = buddy_alloc(&zones[zl[i]], order);
+    spin_unlock_irqrestore(&pfa_lock, flags);
+    return paddr;
+}
+
+static uint64_t zero_pool_take(int preferred);
+
+static uint64_t zone_alloc_pages(int preferred, uint32_t order) {
+    uint64_t paddr = zone_try_alloc(preferred, order);
+    // Frames cached on other CPUs, or keeping their buddies from merging
+    // into a large enough block, may still cover the request
+    if (!paddr && pcp_drain_all()) paddr = zone_try_alloc(preferred, order);
+    // Last come the frames idle CPUs zeroed ahead of time
+    if (!paddr && order == 0) paddr = zero_pool_take(preferred);
+    return paddr;
+}
+
+uint64_t pfa_alloc() {
+    return zone_alloc_pages(ZONE_NORMAL, 0);
+}
 
 void pfa_free(uint64_t paddr) {
-    // Put low pages in the low stack
-    if (paddr < 0x100000000ULL && low_page_stack_top < MAX_LOW_PAGES - 1) {
-        low_page_stack[++low_page_stack_top] = paddr;
+    if (!paddr || (paddr & (PAGE_SIZE - 1)) || paddr >= pfa_limit) return;
+
+    uint64_t flags = local_irq_save();
+    struct pcp_magazine *mag = &pcp_magazines[smp_processor_id()][zone_index(paddr)];
+    spin_lock(&mag->lock);
+    uint8_t *meta = &frame_meta[paddr >> PAGE_SHIFT];
+    if (*meta & (FRAME_FREE | FRAME_CACHED)) {
+        spin_unlock(&mag->lock);
+        local_irq_restore(flags);
+        kprintf("MM: double free of frame 0x%lx ignored\n", 0xFF0000, paddr);
+        return;
+    }
+    *meta = FRAME_CACHED;
+    if (mag->count == PCP_CAPACITY) pcp_drain(mag, PCP_BATCH);
+    mag->frames[mag->count++] = paddr;
+    spin_unlock(&mag->lock);
+    local_irq_restore(flags);
+}
+
+uint64_t pfa_alloc_pages(uint32_t order) {
+    return zone_alloc_pages(ZONE_NORMAL, order);
+}
+
+uint64_t pfa_alloc_pages_low(uint32_t order) {
+    return zone_alloc_pages(ZONE_DMA32, order);
+}
+
+void pfa_free_pages(uint64_t paddr, uint32_t order) {
+    if (order == 0) {
+        pfa_free(paddr);
         return;
     }
-    if (page_stack_top < MAX_PAGES - 1) {
-        page_stack[++page_stack_top] = paddr;
+
+    uint64_t flags = spin_lock_irqsave(&pfa_lock);
+    buddy_free(paddr, order);
+    spin_unlock_irqrestore(&pfa_lock, flags);
+}
+
+// Return frames [first, end) to the buddy lists as the largest naturally
+// aligned blocks that fit. Caller holds pfa_lock.
+static void buddy_free_range(uint64_t first, uint64_t end) {
+    while (first < end) {
+        uint32_t order = 0;
+        while (order < PFA_MAX_ORDER && !(first & (1ULL << order)) &&
+               first + (2ULL << order) <= end) order++;
+        buddy_free(first << PAGE_SHIFT, order);
+        first += 1ULL << order;
     }
 }
 
-// Allocate from low memory (for page tables that need identity mapping)
+// Allocate exactly enough frames for size bytes. The power-of-two block is
+// trimmed, so the tail beyond size goes straight back to the allocator.
+uint64_t pfa_alloc_pages_exact(size_t size) {
+    uint32_t order = pfa_order_for_size(size);
+    if (order > PFA_MAX_ORDER) return 0;
+    uint64_t paddr = pfa_alloc_pages(order);
+    if (!paddr) return 0;
+
+    uint64_t first = paddr >> PAGE_SHIFT;
+    uint64_t used = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint64_t flags = spin_lock_irqsave(&pfa_lock);
+    frame_meta[first] = 0; // No longer a single block of that order
+    buddy_free_range(first + used, first + (1ULL << order));
+    spin_unlock_irqrestore(&pfa_lock, flags);
+    return paddr;
+}
+
+// Free a range obtained from pfa_alloc_pages_exact; size must match.
+void pfa_free_pages_exact(uint64_t paddr, size_t size) {
+    uint64_t first = paddr >> PAGE_SHIFT;
+    uint64_t flags = spin_lock_irqsave(&pfa_lock);
+    buddy_free_range(first, first + ((size + PAGE_SIZE - 1) >> PAGE_SHIFT));
+    spin_unlock_irqrestore(&pfa_lock, flags);
+}
+
+uint32_t pfa_block_order(uint64_t paddr) {
+    if (paddr >= pfa_limit) return 0;
+    return frame_meta[paddr >> PAGE_SHIFT] & FRAME_ORDER_MASK;
+}
+
+// Allocate from the DMA32 zone (page tables, 32-bit DMA)
 uint64_t pfa_alloc_low(void) {
-    if (low_page_stack_top >= 0) {
-        return low_page_stack[low_page_stack_top--];
-    }
-    // Fallback to regular allocator if low stack empty (look for low pages)
-    for (int64_t i = page_stack_top; i >= 0; i--) {
-        if (page_stack[i] < 0x100000000ULL) {
-            uint64_t result = page_stack[i];
-            // Remove from stack by shifting
-            for (int64_t j = i; j < page_stack_top; j++) {
-                page_stack[j] = page_stack[j + 1];
+    return zone_alloc_pages(ZONE_DMA32, 0);
+}
+
+// --- Pre-zeroed pages ---
+// Idle CPUs zero free frames with non-temporal stores (so the cache keeps
+// the working set) and park them in a small per-zone pool. pfa_alloc_zeroed
+// and pfa_alloc_low_zeroed take from the pool and only clear a page on the
+// spot when it is empty; every other single-frame allocation falls back to
+// the pool once its zones run dry.
+#define ZERO_POOL_PAGES 128
+
+// Below this many free frames a zone's pool is no longer topped up, so the
+// pool does not compete with real allocations when memory runs low
+#define ZERO_POOL_MIN_FREE 1024
+
+struct zero_pool {
+    uint32_t count;
+    uint64_t frames[ZERO_POOL_PAGES];
+    uint64_t hits;   // Allocations served pre-zeroed
+    uint64_t misses; // Allocations zeroed on the spot
+};
+
+static spinlock_t zero_lock = SPINLOCK_INIT;
+static struct zero_pool zero_pools[NR_ZONES];
+
+static void zero_page_nt(void *page) {
+    uint64_t *p = page;
+    for (int i = 0; i < PAGE_SIZE / 8; i += 4) {
+        asm volatile("movnti %1, 0(%0)\n\t"
+                     "movnti %1, 8(%0)\n\t"
+                     "movnti %1, 16(%0)\n\t"
+                     "movnti %1, 24(%0)"
+                     :: "r"(p + i), "r"(0ULL) : "memory");
+    }
+    // Make the streaming stores visible before the page is published
+    asm volatile("sfence" ::: "memory");
+}
+
+// Zero a page the caller is about to use; regular stores keep it cached
+static void zero_page(void *page) {
+    void *dst = page;
+    uint64_t count = PAGE_SIZE / 8;
+    asm volatile("rep stosq" : "+D"(dst), "+c"(count) : "a"(0ULL) : "memory");
+}
+
+int pfa_zero_idle(uint32_t budget) {
+    uint32_t done = 0;
+    for (int z = 0; z < NR_ZONES && done < budget; z++) {
+        while (done < budget && zero_pools[z].count < ZERO_POOL_PAGES &&
+               zones[z].free_pages > ZERO_POOL_MIN_FREE) {
+            // Take the frame from this zone only, never from a fallback
+            uint64_t flags = local_irq_save();
+            uint64_t paddr = pcp_take(&pcp_magazines[smp_processor_id()][z], z);
+            local_irq_restore(flags);
+            if (!paddr) break;
+
+            zero_page_nt(phys_to_virt(paddr));
+
+            flags = spin_lock_irqsave(&zero_lock);
+            int stored = zero_pools[z].count < ZERO_POOL_PAGES;
+            if (stored) {
+                frame_meta[paddr >> PAGE_SHIFT] = FRAME_CACHED;
+                zero_pools[z].frames[zero_pools[z].count++] = paddr;
             }
-            page_stack_top--;
-            return result;
+            spin_unlock_irqrestore(&zero_lock, flags);
+            if (!stored) {
+                pfa_free(paddr);
+                break;
+            }
+            done++;
         }
     }
-    return 0; // No low memory available
+    return done;
 }
 
-uint64_t pfa_alloc() {
-    if (page_stack_top >= 0) {
-        return page_stack[page_stack_top--];
+// Pop a pre-zeroed frame from the first zone in the fallback list that has one
+static uint64_t zero_pool_take(int preferred) {
+    const int *zl = zone_fallback[preferred];
+    uint64_t paddr = 0;
+
+    uint64_t flags = spin_lock_irqsave(&zero_lock);
+    for (int i = 0; zl[i] >= 0 && !paddr; i++) {
+        struct zero_pool *pool = &zero_pools[zl[i]];
+        if (pool->count) paddr = pool->frames[--pool->count];
     }
-    // Out of memory
-    return 0;
+    if (paddr) {
+        frame_meta[paddr >> PAGE_SHIFT] = 0;
+        zero_pools[zone_index(paddr)].hits++;
+    }
+    spin_unlock_irqrestore(&zero_lock, flags);
+    return paddr;
+}
+
+static uint64_t zone_alloc_zeroed(int preferred) {
+    uint64_t paddr = zero_pool_take(preferred);
+    if (paddr) return paddr;
+
+    __atomic_add_fetch(&zero_pools[preferred].misses, 1, __ATOMIC_RELAXED);
+    paddr = zone_alloc_pages(preferred, 0);
+    if (paddr) zero_page(phys_to_virt(paddr));
+    return paddr;
+}
+
+uint64_t pfa_alloc_zeroed(void) {
+    return zone_alloc_zeroed(ZONE_NORMAL);
+}
+
+uint64_t pfa_alloc_low_zeroed(void) {
+    return zone_alloc_zeroed(ZONE_DMA32);
+}
+
+int mm_format_pcp_stats(char *buf, int size) {
+    extern int sprintf(char *buf, const char *fmt, ...);
+    int len = 0;
+    for (int z = 0; z < NR_ZONES && size - len >= 160; z++) {
+        len += sprintf(buf + len, "zone %s: managed %lu free %lu\n", zones[z].name,
+                       zones[z].managed_pages, zones[z].free_pages);
+        len += sprintf(buf + len, "zone %s: zeroed %u hits %lu misses %lu\n", zones[z].name,
+                       zero_pools[z].count, zero_pools[z].hits, zero_pools[z].misses);
+    }
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        for (int z = 0; z < NR_ZONES; z++) {
+            struct pcp_magazine *mag = &pcp_magazines[cpu][z];
+            if (!mag->refills && !mag->drains && !mag->count) continue;
+            if (size - len < 96) return len;
+            len += sprintf(buf + len, "cpu%d %s: cached %u refills %lu drains %lu\n",
+                           cpu, zones[z].name, mag->count, mag->refills, mag->drains);
+        }
+    }
+    return len;
 }
 
 // Memory statistics getters
@@ -106,94 +511,433 @@ uint64_t mm_get_total_memory(void) {
 }
 
 uint64_t mm_get_free_memory(void) {
-    return (page_stack_top + 1) * PAGE_SIZE;
+    uint64_t pages = 0;
+    for (int z = 0; z < NR_ZONES; z++) pages += zones[z].free_pages + zero_pools[z].count;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        for (int z = 0; z < NR_ZONES; z++) pages += pcp_magazines[cpu][z].count;
+    }
+    return pages * PAGE_SIZE;
 }
 
 // --- Virtual Memory Manager (VMM) ---
-#define PAGE_PRESENT (1 << 0)
-#define PAGE_RW      (1 << 1)
-#define PAGE_USER    (1 << 2)
-#define PAGE_PWT     (1 << 3)
-#define PAGE_PCD     (1 << 4) // Page Cache Disable
-#define PAGE_NO_EXEC (1ULL << 63)
-
-// MMIO virtual address region. Initialized in mm_init.
-static uint64_t next_mmio_addr;
-
-// This function maps a single page.
-static void map_page(uint64_t phys_addr, uint64_t virt_addr, uint64_t flags) {
-    uint64_t pml4_index = (virt_addr >> 39) & 0x1FF;
-    uint64_t pdpt_index = (virt_addr >> 30) & 0x1FF;
-    uint64_t pdt_index  = (virt_addr >> 21) & 0x1FF;
-    uint64_t pt_index   = (virt_addr >> 12) & 0x1FF;
-
-    // Extract caching flags to apply them to all levels of the page table hierarchy for consistency.
-    uint64_t caching_flags = flags & (PAGE_PWT | PAGE_PCD);
+// Page flags (PAGE_PRESENT etc.) live in mm.h
+#define PAGE_HUGE    (1 << 7) // PS bit in a PDPT/PD entry
+
+// Define a mask to extract the physical address from a page table entry.
+// This clears flags (lower 12 bits) and any implementation-defined bits (upper 12 bits).
+// It preserves the 40-bit physical address field (bits 12 to 51).
+#define PADDR_MASK 0x000FFFFFFFFFF000ULL
 
-    // Define a mask to extract the physical address from a page table entry.
-    // This clears flags (lower 12 bits) and any implementation-defined bits (upper 12 bits).
-    // It preserves the 40-bit physical address field (bits 12 to 51).
-    const uint64_t PADDR_MASK = 0x000FFFFFFFFFF000;
+#define PAGE_2M (1ULL << 21)
+#define PAGE_1G (1ULL << 30)
+#define PAGE_PAT_LARGE (1ULL << 12) // PAT bit in a 2 MiB/1 GiB entry
 
+// IA32_PAT. Entries 0-3 keep their power-on types so PWT/PCD mean what
+// they always did; entry 4 (PAT bit alone) becomes write-combining.
+#define MSR_IA32_PAT 0x277
+#define PAT_UC       0x00ULL
+#define PAT_WC       0x01ULL
+#define PAT_WT       0x04ULL
+#define PAT_WB       0x06ULL
+#define PAT_UC_MINUS 0x07ULL
+#define PAT_VALUE    (PAT_WB | (PAT_WT << 8) | (PAT_UC_MINUS << 16) | (PAT_UC << 24) | \
+                      (PAT_WC << 32) | (PAT_WT << 40) | (PAT_UC_MINUS << 48) | (PAT_UC << 56))
+
+// Set by mm_pat_init when the CPU has PAT
+static int pat_enabled = 0;
+
+// Above this many entries a single CR3 reload is cheaper than invlpg each
+#define TLB_FLUSH_THRESHOLD 32
+
+struct tlb_stats {
+    uint64_t invlpg;       // Single-entry invalidations
+    uint64_t full_flushes; // CR3 reloads
+    uint64_t shootdowns;   // Batches also sent to the other CPUs
+} __attribute__((aligned(64)));
+
+static struct tlb_stats tlb_stats[MAX_CPUS];
+
+// Set in mm_init when CPUID reports 1 GiB page support (pdpe1gb)
+static int cpu_has_1g_pages = 0;
+
+// Return the table the entry points to, creating it if requested.
+static uint64_t *next_table(uint64_t *entry, uint64_t caching_flags, int create, uint64_t virt_addr) {
+    if (!(*entry & PAGE_PRESENT)) {
+        if (!create) return NULL;
+        uint64_t table_phys = pfa_alloc_low_zeroed();  // Use low memory for page tables
+        if (!table_phys) {
+            kprintf("MM: failed to allocate page table for virt 0x%lx\n", 0xFF0000, virt_addr);
+            return NULL; // Out of memory
+        }
+        *entry = table_phys | PAGE_PRESENT | PAGE_RW | caching_flags;
+    } else if (*entry & PAGE_HUGE) {
+        kprintf("MM: virt 0x%lx is inside a large page\n", 0xFF0000, virt_addr);
+        return NULL;
+    } else {
+        // Entry already exists, ensure caching flags are set for the hierarchy.
+        *entry |= caching_flags;
+    }
+    return phys_to_virt(*entry & PADDR_MASK);
+}
+
+// Walk down to the table at `level` (3 = PDPT, 2 = PD, 1 = PT) covering virt_addr.
+static uint64_t *walk_table(uint64_t virt_addr, int level, uint64_t caching_flags, int create) {
     uint64_t pml4_phys;
     asm volatile("mov %%cr3, %0" : "=r"(pml4_phys));
-    
+
     // Access all page table levels through the direct physical map.
-    // This assumes the bootloader has created this mapping for the kernel to use.
-    uint64_t *pml4_virt = phys_to_virt(pml4_phys & PADDR_MASK);
-
-    // PML4 -> PDPT
-    if (!(pml4_virt[pml4_index] & PAGE_PRESENT)) {
-        uint64_t pdpt_phys = pfa_alloc_low();  // Use low memory for page tables
-        if (!pdpt_phys) {
-            kprintf("MM: map_page failed to allocate PDPT for virt 0x%lx\n", 0xFF0000, virt_addr);
-            return; // Out of memory
+    uint64_t *table = phys_to_virt(pml4_phys & PADDR_MASK);
+    for (int l = 4; l > level; l--) {
+        uint64_t *entry = &table[(virt_addr >> (12 + 9 * (l - 1))) & 0x1FF];
+        table = next_table(entry, caching_flags, create, virt_addr);
+        if (!table) return NULL;
+    }
+    return table;
+}
+
+// Invalidations for one map/unmap call. Falls back to a full flush once
+// more than TLB_FLUSH_THRESHOLD entries changed.
+struct tlb_batch {
+    uint64_t addrs[TLB_FLUSH_THRESHOLD];
+    uint32_t count;
+    int full;
+};
+
+static void tlb_batch_add(struct tlb_batch *batch, uint64_t virt) {
+    if (batch->count < TLB_FLUSH_THRESHOLD) batch->addrs[batch->count++] = virt;
+    else batch->full = 1;
+}
+
+// Invalidate a list of pages, or everything, in this CPU's TLB
+void mm_tlb_invalidate(const uint64_t *addrs, uint32_t count, int full) {
+    struct tlb_stats *stats = &tlb_stats[smp_processor_id()];
+    if (full) {
+        asm volatile("mov %%cr3, %%rax; mov %%rax, %%cr3" ::: "rax", "memory");
+        stats->full_flushes++;
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        asm volatile("invlpg (%0)" :: "r"(addrs[i]) : "memory");
+    }
+    stats->invlpg += count;
+}
+
+// Every CPU shares the kernel page tables, so a changed or removed entry
+// may be cached in any of their TLBs
+static void tlb_batch_flush(struct tlb_batch *batch) {
+    if (!batch->full && batch->count == 0) return;
+    mm_tlb_invalidate(batch->addrs, batch->count, batch->full);
+    if (smp_tlb_shootdown(batch->addrs, batch->count, batch->full)) {
+        tlb_stats[smp_processor_id()].shootdowns++;
+    }
+}
+
+// Map [virt, virt + size) with a single large page at `level` (3 = 1 GiB,
+// 2 = 2 MiB) if alignment, size and the existing tables allow it.
+static int map_large(uint64_t phys, uint64_t virt, uint64_t remaining, int level,
+                     uint64_t flags, struct tlb_batch *batch) {
+    uint64_t size = level == 3 ? PAGE_1G : PAGE_2M;
+    if (level == 3 && !cpu_has_1g_pages) return 0;
+    if (((phys | virt) & (size - 1)) || remaining < size) return 0;
+
+    uint64_t *table = walk_table(virt, level, flags & (PAGE_PWT | PAGE_PCD), 1);
+    if (!table) return 0;
+    uint64_t *entry = &table[(virt >> (12 + 9 * (level - 1))) & 0x1FF];
+    // Never drop a table that already maps smaller pages here
+    if ((*entry & PAGE_PRESENT) && !(*entry & PAGE_HUGE)) return 0;
+
+    // The PAT bit moves from bit 7 (the PS bit here) to bit 12
+    uint64_t large_flags = flags;
+    if (large_flags & PAGE_PAT) large_flags = (large_flags & ~(uint64_t)PAGE_PAT) | PAGE_PAT_LARGE;
+
+    // Only a previously present entry can be cached in a TLB
+    uint64_t old = *entry;
+    *entry = phys | large_flags | PAGE_HUGE;
+    if (old & PAGE_PRESENT) tlb_batch_add(batch, virt);
+    return 1;
+}
+
+int map_range(uint64_t phys, uint64_t virt, size_t npages, uint64_t flags) {
+    // Without PAT, write-combining degrades to uncached
+    if ((flags & PAGE_PAT) && !pat_enabled) flags = (flags & ~(uint64_t)PAGE_PAT) | PAGE_PCD | PAGE_PWT;
+
+    // Apply the caching flags to all levels of the hierarchy for consistency.
+    uint64_t caching_flags = flags & (PAGE_PWT | PAGE_PCD);
+    uint64_t total = (uint64_t)npages * PAGE_SIZE;
+    uint64_t done = 0;
+    struct tlb_batch batch = { .count = 0, .full = 0 };
+
+    while (done < total) {
+        uint64_t p = phys + done, v = virt + done;
+
+        // Use the largest page size that alignment and the remaining length allow
+        if (map_large(p, v, total - done, 3, flags, &batch)) { done += PAGE_1G; continue; }
+        if (map_large(p, v, total - done, 2, flags, &batch)) { done += PAGE_2M; continue; }
+
+        // 4 KiB pages: one walk per page table, then fill consecutive entries
+        // up to the end of the table or the next 2 MiB-mappable boundary
+        uint64_t *pt = walk_table(v, 1, caching_flags, 1);
+        if (!pt) break;
+        for (uint64_t idx = (v >> 12) & 0x1FF; idx < 512 && done < total; idx++) {
+            uint64_t old = pt[idx];
+            pt[idx] = (phys + done) | flags;
+            if (old & PAGE_PRESENT) tlb_batch_add(&batch, virt + done);
+            done += PAGE_SIZE;
         }
-        custom_memset(phys_to_virt(pdpt_phys), 0, PAGE_SIZE);
-        pml4_virt[pml4_index] = pdpt_phys | PAGE_PRESENT | PAGE_RW | caching_flags;
-    } else {
-        // Entry already exists, ensure caching flags are set for the hierarchy.
-        pml4_virt[pml4_index] |= caching_flags;
     }
-    uint64_t *pdpt_virt = phys_to_virt(pml4_virt[pml4_index] & PADDR_MASK);
 
-    // PDPT -> PDT
-    if (!(pdpt_virt[pdpt_index] & PAGE_PRESENT)) {
-        uint64_t pdt_phys = pfa_alloc_low();  // Use low memory for page tables
-        if (!pdt_phys) {
-            kprintf("MM: map_page failed to allocate PDT for virt 0x%lx\n", 0xFF0000, virt_addr);
-            return;
+    tlb_batch_flush(&batch);
+    return done >= total ? 0 : -1;
+}
+
+void unmap_range(uint64_t virt, size_t npages) {
+    uint64_t end = virt + (uint64_t)npages * PAGE_SIZE;
+    struct tlb_batch batch = { .count = 0, .full = 0 };
+
+    while (virt < end) {
+        uint64_t *pdpt = walk_table(virt, 3, 0, 0);
+        uint64_t *pdpte = pdpt ? &pdpt[(virt >> 30) & 0x1FF] : NULL;
+        if (!pdpte || !(*pdpte & PAGE_PRESENT)) {
+            virt = (virt + PAGE_1G) & ~(PAGE_1G - 1);
+            continue;
+        }
+        if (*pdpte & PAGE_HUGE) {
+            *pdpte = 0;
+            tlb_batch_add(&batch, virt);
+            virt = (virt + PAGE_1G) & ~(PAGE_1G - 1);
+            continue;
+        }
+
+        uint64_t *pd = phys_to_virt(*pdpte & PADDR_MASK);
+        uint64_t *pde = &pd[(virt >> 21) & 0x1FF];
+        if (!(*pde & PAGE_PRESENT)) {
+            virt = (virt + PAGE_2M) & ~(PAGE_2M - 1);
+            continue;
+        }
+        if (*pde & PAGE_HUGE) {
+            *pde = 0;
+            tlb_batch_add(&batch, virt);
+            virt = (virt + PAGE_2M) & ~(PAGE_2M - 1);
+            continue;
+        }
+
+        uint64_t *pt = phys_to_virt(*pde & PADDR_MASK);
+        for (uint64_t idx = (virt >> 12) & 0x1FF; idx < 512 && virt < end; idx++) {
+            if (pt[idx] & PAGE_PRESENT) {
+                pt[idx] = 0;
+                tlb_batch_add(&batch, virt);
+            }
+            virt += PAGE_SIZE;
         }
-        custom_memset(phys_to_virt(pdt_phys), 0, PAGE_SIZE);
-        pdpt_virt[pdpt_index] = pdt_phys | PAGE_PRESENT | PAGE_RW | caching_flags;
-    } else {
-        pdpt_virt[pdpt_index] |= caching_flags;
     }
-    uint64_t *pdt_virt = phys_to_virt(pdpt_virt[pdpt_index] & PADDR_MASK);
 
-    // PDT -> PT
-    if (!(pdt_virt[pdt_index] & PAGE_PRESENT)) {
-        uint64_t pt_phys = pfa_alloc_low();  // Use low memory for page tables
-        if (!pt_phys) {
-            kprintf("MM: map_page failed to allocate PT for virt 0x%lx\n", 0xFF0000, virt_addr);
-            return;
+    tlb_batch_flush(&batch);
+}
+
+int mm_format_tlb_stats(char *buf, int size) {
+    extern int sprintf(char *buf, const char *fmt, ...);
+    int len = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct tlb_stats *stats = &tlb_stats[cpu];
+        if (!stats->invlpg && !stats->full_flushes) continue;
+        if (size - len < 128) break;
+        len += sprintf(buf + len, "cpu%d: invlpg %lu full_flushes %lu shootdowns %lu\n",
+                       cpu, stats->invlpg, stats->full_flushes, stats->shootdowns);
+    }
+    return len;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+void mm_pat_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & (1 << 16))) {
+        kprintf("MM: CPU has no PAT, write-combining falls back to UC\n", 0xFFFF0000);
+        return;
+    }
+
+    // No mapping uses the PAT bit yet, so only stale cache lines and TLB
+    // entries need to go after the switch.
+    uint64_t flags = local_irq_save();
+    if (rdmsr(MSR_IA32_PAT) != PAT_VALUE) {
+        wrmsr(MSR_IA32_PAT, PAT_VALUE);
+        asm volatile("wbinvd; mov %%cr3, %%rax; mov %%rax, %%cr3" ::: "rax", "memory");
+    }
+    local_irq_restore(flags);
+    pat_enabled = 1;
+}
+
+// True if [start, end) lies inside a single usable memory map entry
+static int mmap_range_usable(struct multiboot_tag_mmap *mmap_tag, uint32_t num_entries,
+                             uint64_t start, uint64_t end) {
+    for (uint32_t i = 0; i < num_entries; i++) {
+        struct multiboot_mmap_entry *entry = &mmap_tag->entries[i];
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE) continue;
+        if (start >= entry->addr && end <= entry->addr + entry->len) return 1;
+    }
+    return 0;
+}
+
+// Page directory mapping the usable RAM in the GiB at `base`: 2 MiB pages
+// where a whole 2 MiB block is usable, a page table of 4 KiB pages where
+// only part of it is. Returns its physical address, or 0 if out of memory.
+static uint64_t direct_map_build_pd(struct multiboot_tag_mmap *mmap_tag, uint32_t num_entries,
+                                    uint64_t base) {
+    uint64_t pd_phys = pfa_alloc_low_zeroed();
+    if (!pd_phys) return 0;
+    uint64_t *pd = phys_to_virt(pd_phys);
+
+    for (int i = 0; i < 512; i++) {
+        uint64_t block = base + (uint64_t)i * PAGE_2M;
+        if (mmap_range_usable(mmap_tag, num_entries, block, block + PAGE_2M)) {
+            pd[i] = block | PAGE_PRESENT | PAGE_RW | PAGE_HUGE;
+            continue;
         }
-        custom_memset(phys_to_virt(pt_phys), 0, PAGE_SIZE);
-        pdt_virt[pdt_index] = pt_phys | PAGE_PRESENT | PAGE_RW | caching_flags;
-    } else {
-        pdt_virt[pdt_index] |= caching_flags;
+
+        uint64_t pt_phys = 0;
+        uint64_t *pt = NULL;
+        for (int j = 0; j < 512; j++) {
+            uint64_t page = block + (uint64_t)j * PAGE_SIZE;
+            if (!mmap_range_usable(mmap_tag, num_entries, page, page + PAGE_SIZE)) continue;
+            if (!pt) {
+                pt_phys = pfa_alloc_low_zeroed();
+                if (!pt_phys) return 0;
+                pt = phys_to_virt(pt_phys);
+            }
+            pt[j] = page | PAGE_PRESENT | PAGE_RW;
+        }
+        if (pt) pd[i] = pt_phys | PAGE_PRESENT | PAGE_RW;
     }
-    uint64_t *pt_virt = phys_to_virt(pdt_virt[pdt_index] & PADDR_MASK);
+    return pd_phys;
+}
 
-    // Map the page in the Page Table
-    pt_virt[pt_index] = phys_addr | flags;
+// Give the direct map a PDPT of its own (the boot one is shared with the
+// identity map) that maps usable RAM only. Below 4 GiB a GiB that is all
+// usable RAM gets a 1 GiB entry and the rest are built from the memory
+// map; above 4 GiB map_range maps each usable region. Regions are shrunk
+// to whole pages, never widened: a write-back page reaching into a
+// reserved or MMIO range (the PCI hole, LAPIC, framebuffer) would make it
+// cacheable, and a large page spanning MTRR types is undefined.
+static void direct_map_init(struct multiboot_tag_mmap *mmap_tag, uint32_t num_entries) {
+    uint64_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    uint64_t *pml4 = phys_to_virt(cr3 & PADDR_MASK);
+    uint64_t *boot_pdpt = phys_to_virt(pml4[256] & PADDR_MASK);
 
-    // Ensure all writes to page tables are globally visible before flushing TLB
-    asm volatile("mfence" ::: "memory");
+    uint64_t pdpt_phys = pfa_alloc_low();
+    if (!pdpt_phys) {
+        kprintf("MM: No memory for the direct map PDPT\n", 0xFF0000);
+        return;
+    }
+    uint64_t *pdpt = phys_to_virt(pdpt_phys);
+    for (int i = 0; i < 512; i++) pdpt[i] = boot_pdpt[i];
 
-    // A full CR3 reload is necessary to flush all paging-structure caches (for the
-    // hierarchy) and the TLB. This is simpler and more robust than invlpg.
+    // The tables are built while the boot map is still live, then swapped
+    // in at once. Usable RAM keeps its address, so the switch is seamless.
+    for (uint64_t i = 0; i < BOOT_MAPPED_LIMIT / PAGE_1G; i++) {
+        uint64_t base = i * PAGE_1G;
+        if (cpu_has_1g_pages && mmap_range_usable(mmap_tag, num_entries, base, base + PAGE_1G)) {
+            pdpt[i] = base | PAGE_PRESENT | PAGE_RW | PAGE_HUGE;
+            continue;
+        }
+        uint64_t pd_phys = direct_map_build_pd(mmap_tag, num_entries, base);
+        if (!pd_phys) {
+            kprintf("MM: No memory for the direct map below 4 GiB\n", 0xFF0000);
+            return;
+        }
+        pdpt[i] = pd_phys | PAGE_PRESENT | PAGE_RW;
+    }
+    pml4[256] = pdpt_phys | PAGE_PRESENT | PAGE_RW;
     asm volatile("mov %%cr3, %%rax; mov %%rax, %%cr3" ::: "rax", "memory");
+
+    for (uint32_t i = 0; i < num_entries; i++) {
+        struct multiboot_mmap_entry *entry = &mmap_tag->entries[i];
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE) continue;
+        uint64_t start = (entry->addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t end = (entry->addr + entry->len) & ~(uint64_t)(PAGE_SIZE - 1);
+        if (start < BOOT_MAPPED_LIMIT) start = BOOT_MAPPED_LIMIT;
+        if (start >= end) continue;
+
+        if (map_range(start, DIRECT_MAP_OFFSET + start, (end - start) / PAGE_SIZE,
+                      PAGE_PRESENT | PAGE_RW) != 0) {
+            kprintf("MM: Failed to direct-map 0x%lx - 0x%lx\n", 0xFF0000, start, end);
+            break;
+        }
+        if (end > direct_map_end) direct_map_end = end;
+    }
+    kprintf("MM: Direct map covers 0x0 - 0x%lx at 0x%lx\n", 0x00FF0000, direct_map_end, DIRECT_MAP_OFFSET);
+}
+
+// MMIO window: high MMIO is mapped into free ranges of this region,
+// kept as a sorted list of free extents.
+#define MMIO_WINDOW_START 0xFFFFFFFF80000000ULL
+#define MMIO_WINDOW_END   0xFFFFFFFFFFFFF000ULL
+#define MMIO_MAX_RANGES   32
+
+static spinlock_t mmio_lock = SPINLOCK_INIT;
+static struct { uint64_t start; uint64_t end; } mmio_free_ranges[MMIO_MAX_RANGES];
+static int mmio_free_count = 0;
+
+// Physical ranges handed out before the PFA exists: the kernel image, the
+// multiboot information, boot modules and the frame metadata array. Page
+// aligned.
+#define MAX_BOOT_RESERVED 12
+static struct { uint64_t start; uint64_t end; } boot_reserved[MAX_BOOT_RESERVED];
+static int boot_reserved_count = 0;
+
+static void boot_reserve(uint64_t start, uint64_t end) {
+    if (boot_reserved_count >= MAX_BOOT_RESERVED) {
+        kprintf("MM: Too many reserved ranges, dropping 0x%lx - 0x%lx\n", 0xFF0000, start, end);
+        return;
+    }
+    boot_reserved[boot_reserved_count].start = start & ~(uint64_t)(PAGE_SIZE - 1);
+    boot_reserved[boot_reserved_count].end = (end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    boot_reserved_count++;
+}
+
+// Returns the first reserved range overlapping [start, end), or -1
+static int boot_reserved_overlap(uint64_t start, uint64_t end, int from) {
+    for (int r = from; r < boot_reserved_count; r++) {
+        if (start < boot_reserved[r].end && end > boot_reserved[r].start) return r;
+    }
+    return -1;
+}
+
+// Hand a page-aligned range to the buddy allocator as the largest naturally
+// aligned blocks that fit, so the cost is per block rather than per page.
+static void pfa_add_range(uint64_t start, uint64_t end) {
+    while (start < end) {
+        uint32_t order = 0;
+        while (order < PFA_MAX_ORDER) {
+            uint64_t size = (uint64_t)PAGE_SIZE << (order + 1);
+            if ((start & (size - 1)) || start + size > end) break;
+            order++;
+        }
+        buddy_free(start, order);
+        zones[zone_index(start)].managed_pages += 1ULL << order;
+        total_pages_added += 1LL << order;
+        start += (uint64_t)PAGE_SIZE << order;
+    }
+}
+
+// Add a usable range minus any reserved ranges it overlaps
+static void pfa_add_usable(uint64_t start, uint64_t end, int from) {
+    int r = boot_reserved_overlap(start, end, from);
+    if (r < 0) {
+        pfa_add_range(start, end);
+        return;
+    }
+    if (start < boot_reserved[r].start) pfa_add_usable(start, boot_reserved[r].start, r + 1);
+    if (boot_reserved[r].end < end) pfa_add_usable(boot_reserved[r].end, end, r + 1);
 }
 
 void mm_init(uint64_t multiboot_addr) {
@@ -216,6 +960,16 @@ void mm_init(uint64_t multiboot_addr) {
 
     kprintf("MM: mmap_tag->common.size = %u, mmap_tag->entry_size = %u\n", 0x00FF0000, mmap_tag->common.size, mmap_tag->entry_size);
 
+    mm_pat_init();
+
+    // Check for 1 GiB page support (CPUID 0x80000001, EDX bit 26)
+    uint32_t max_ext, eax, edx;
+    asm volatile("cpuid" : "=a"(max_ext) : "a"(0x80000000) : "rbx", "rcx", "rdx");
+    if (max_ext >= 0x80000001) {
+        asm volatile("cpuid" : "=a"(eax), "=d"(edx) : "a"(0x80000001) : "rbx", "rcx");
+        cpu_has_1g_pages = (edx >> 26) & 1;
+    }
+
     // Get the physical address of the end of the kernel from the linker script.
     uint64_t kernel_end_addr = (uint64_t)&kernel_end;
     // Align the kernel end address up to the next page boundary to be safe.
@@ -224,6 +978,15 @@ void mm_init(uint64_t multiboot_addr) {
     }
     kprintf("MM: Kernel image ends at 0x%lx. Reserving memory below this.\n", 0x00FF0000, kernel_end_addr);
 
+    // Everything below the end of the kernel image stays reserved
+    boot_reserve(0, kernel_end_addr);
+
+    // So does the multiboot information: its tags (memory map, ACPI RSDP,
+    // framebuffer, modules) are still read here and after mm_init returns.
+    // GRUB tends to place it right after the kernel, where the frame
+    // metadata would otherwise go.
+    boot_reserve(multiboot_addr, multiboot_addr + *(uint32_t *)multiboot_addr);
+
     // Find module memory ranges to exclude from PFA
     struct multiboot_tag_module {
         struct multiboot_tag common;
@@ -232,68 +995,179 @@ void mm_init(uint64_t multiboot_addr) {
         char cmdline[];
     } PACKED;
     
-    struct { uint64_t start; uint64_t end; } reserved_ranges[10];
-    int reserved_count = 0;
-    
     // Scan tags for modules
     struct multiboot_tag *mod_tag = (struct multiboot_tag *)(multiboot_addr + 8);
     for (; mod_tag->type != 0; mod_tag = (struct multiboot_tag *)((uint8_t *)mod_tag + ((mod_tag->size + 7) & ~7))) {
         if (mod_tag->type == 3) { // Module tag
              struct multiboot_tag_module *m = (struct multiboot_tag_module *)mod_tag;
-             if (reserved_count < 10) {
-                 reserved_ranges[reserved_count].start = m->mod_start;
-                 reserved_ranges[reserved_count].end = m->mod_end;
-                 kprintf("MM: Reserving module memory: 0x%lx - 0x%lx\n", 0x00FF0000, (uint64_t)m->mod_start, (uint64_t)m->mod_end);
-                 reserved_count++;
-             }
+             kprintf("MM: Reserving module memory: 0x%lx - 0x%lx\n", 0x00FF0000, (uint64_t)m->mod_start, (uint64_t)m->mod_end);
+             boot_reserve(m->mod_start, m->mod_end);
         }
     }
 
-    // Initialize physical frame allocator
+    // Size the frame metadata from the highest usable address
     uint32_t num_entries = (mmap_tag->common.size - sizeof(*mmap_tag)) / mmap_tag->entry_size;
     kprintf("MM: Detected %u memory map entries.\n", 0x00FF0000, num_entries);
     for (uint32_t i = 0; i < num_entries; i++) {
         struct multiboot_mmap_entry *entry = &mmap_tag->entries[i];
-        if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
-            kprintf("MM: Usable RAM at 0x%lx, size 0x%lx\n", 0x00FF0000, entry->addr, entry->len);            
-            // Align start up and end down to page boundaries.
-            uint64_t first_page = (entry->addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-            uint64_t last_page = (entry->addr + entry->len) & ~(PAGE_SIZE - 1);
-            
-            // Add pages in reverse order so the allocator starts with lower addresses.
-            for (uint64_t p = last_page; p > first_page; ) {
-                p -= PAGE_SIZE; 
-                // Don't use pages occupied by the kernel image itself.
-                if (p < kernel_end_addr) {
-                    continue;
-                }
-                
-                // Don't use pages occupied by modules
-                int is_reserved = 0;
-                for (int r = 0; r < reserved_count; r++) {
-                    // Check overlap. Since we check page-by-page (p), simpler check:
-                    // If page p starts within range or ends within range?
-                    // actually, verifying if the page contains any part of the file.
-                    // simpler: if range [p, p+PAGE_SIZE) overlaps [start, end)
-                    if (p < reserved_ranges[r].end && (p + PAGE_SIZE) > reserved_ranges[r].start) {
-                        is_reserved = 1;
-                        break;
-                    }
-                }
-                if (is_reserved) continue;
-                
-                pfa_free(p);
-                total_pages_added++;
-            }
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE) continue;
+        kprintf("MM: Usable RAM at 0x%lx, size 0x%lx\n", 0x00FF0000, entry->addr, entry->len);
+        uint64_t end = (entry->addr + entry->len) & ~(uint64_t)(PAGE_SIZE - 1);
+        if (end > pfa_limit) pfa_limit = end;
+    }
+
+    uint64_t meta_size = ((pfa_limit >> PAGE_SHIFT) + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t meta_phys = 0;
+    for (uint32_t i = 0; i < num_entries && !meta_phys; i++) {
+        struct multiboot_mmap_entry *entry = &mmap_tag->entries[i];
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE) continue;
+        uint64_t start = (entry->addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t end = (entry->addr + entry->len) & ~(uint64_t)(PAGE_SIZE - 1);
+        // Only the boot-mapped part of the direct map exists yet
+        if (end > BOOT_MAPPED_LIMIT) end = BOOT_MAPPED_LIMIT;
+
+        // Step past reserved ranges until the array fits or the region ends
+        int r;
+        while (start + meta_size <= end && (r = boot_reserved_overlap(start, start + meta_size, 0)) >= 0) {
+            start = boot_reserved[r].end;
+        }
+        if (start + meta_size <= end) meta_phys = start;
+    }
+    if (!meta_phys) {
+        kprintf("MM: FATAL - No room for %lu bytes of frame metadata!\n", 0xFF0000, meta_size);
+        pfa_limit = 0;
+        return;
+    }
+    frame_meta = phys_to_virt(meta_phys);
+    custom_memset(frame_meta, 0, meta_size);
+    boot_reserve(meta_phys, meta_phys + meta_size);
+    kprintf("MM: Frame metadata: %lu KiB at 0x%lx\n", 0x00FF0000, meta_size / 1024, meta_phys);
+
+    // Free every usable range below 4 GiB, skipping the reserved ones. The
+    // buddy allocator merges neighbouring blocks across region boundaries.
+    for (uint32_t i = 0; i < num_entries; i++) {
+        struct multiboot_mmap_entry *entry = &mmap_tag->entries[i];
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE) continue;
+        uint64_t start = (entry->addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t end = (entry->addr + entry->len) & ~(uint64_t)(PAGE_SIZE - 1);
+        if (end > BOOT_MAPPED_LIMIT) end = BOOT_MAPPED_LIMIT;
+        if (start < end) pfa_add_usable(start, end, 0);
+    }
+
+    // Map the rest of RAM (page tables come from the frames just added),
+    // then hand it to the allocator.
+    direct_map_init(mmap_tag, num_entries);
+    for (uint32_t i = 0; i < num_entries; i++) {
+        struct multiboot_mmap_entry *entry = &mmap_tag->entries[i];
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE) continue;
+        uint64_t start = (entry->addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t end = (entry->addr + entry->len) & ~(uint64_t)(PAGE_SIZE - 1);
+        if (start < BOOT_MAPPED_LIMIT) start = BOOT_MAPPED_LIMIT;
+        if (end > direct_map_end) end = direct_map_end;
+        if (start < end) pfa_add_usable(start, end, 0);
+    }
+
+    for (int z = 0; z < NR_ZONES; z++) {
+        kprintf("MM: Zone %s: %lu free pages\n", 0x00FF0000, zones[z].name, zones[z].free_pages);
+    }
+    kprintf("MM: PFA initialized with %ld free pages.\n", 0x00FF0000, total_pages_added);
+
+    mmio_free_ranges[0].start = MMIO_WINDOW_START;
+    mmio_free_ranges[0].end = MMIO_WINDOW_END;
+    mmio_free_count = 1;
+    kprintf("MM: MMIO window 0x%lx - 0x%lx, 1 GiB pages %s\n", 0x00FF0000,
+            MMIO_WINDOW_START, MMIO_WINDOW_END, cpu_has_1g_pages ? "on" : "off");
+}
+
+// Allocate size bytes of MMIO window whose address is congruent to phys
+// modulo align, so large pages can be used. First fit.
+static uint64_t mmio_va_alloc(uint64_t size, uint64_t phys, uint64_t align) {
+    uint64_t flags = spin_lock_irqsave(&mmio_lock);
+    uint64_t virt = 0;
+    for (int i = 0; i < mmio_free_count; i++) {
+        uint64_t start = mmio_free_ranges[i].start;
+        uint64_t end = mmio_free_ranges[i].end;
+        uint64_t v = (start & ~(align - 1)) + (phys & (align - 1));
+        if (v < start) v += align;
+        if (v + size > end || v + size < v) continue;
+
+        // Split the free range around the allocation
+        if (v + size < end && v > start) {
+            if (mmio_free_count == MMIO_MAX_RANGES) continue;
+            for (int j = mmio_free_count; j > i + 1; j--) mmio_free_ranges[j] = mmio_free_ranges[j - 1];
+            mmio_free_ranges[i + 1].start = v + size;
+            mmio_free_ranges[i + 1].end = end;
+            mmio_free_count++;
+            mmio_free_ranges[i].end = v;
+        } else if (v > start) {
+            mmio_free_ranges[i].end = v;
+        } else if (v + size < end) {
+            mmio_free_ranges[i].start = v + size;
+        } else {
+            for (int j = i; j < mmio_free_count - 1; j++) mmio_free_ranges[j] = mmio_free_ranges[j + 1];
+            mmio_free_count--;
         }
+        virt = v;
+        break;
+    }
+    spin_unlock_irqrestore(&mmio_lock, flags);
+    return virt;
+}
+
+static void mmio_va_free(uint64_t virt, uint64_t size) {
+    uint64_t flags = spin_lock_irqsave(&mmio_lock);
+    int i = 0;
+    while (i < mmio_free_count && mmio_free_ranges[i].start < virt) i++;
+
+    int merge_prev = i > 0 && mmio_free_ranges[i - 1].end == virt;
+    int merge_next = i < mmio_free_count && mmio_free_ranges[i].start == virt + size;
+    if (merge_prev && merge_next) {
+        mmio_free_ranges[i - 1].end = mmio_free_ranges[i].end;
+        for (int j = i; j < mmio_free_count - 1; j++) mmio_free_ranges[j] = mmio_free_ranges[j + 1];
+        mmio_free_count--;
+    } else if (merge_prev) {
+        mmio_free_ranges[i - 1].end = virt + size;
+    } else if (merge_next) {
+        mmio_free_ranges[i].start = virt;
+    } else if (mmio_free_count < MMIO_MAX_RANGES) {
+        for (int j = mmio_free_count; j > i; j--) mmio_free_ranges[j] = mmio_free_ranges[j - 1];
+        mmio_free_ranges[i].start = virt;
+        mmio_free_ranges[i].end = virt + size;
+        mmio_free_count++;
+    } else {
+        kprintf("MM: MMIO window too fragmented, leaking 0x%lx\n", 0xFF0000, virt);
     }
-    kprintf("MM: PFA initialized with %ld free pages.\n", 0x00FF0000, page_stack_top + 1);
+    spin_unlock_irqrestore(&mmio_lock, flags);
+}
+
+// Map physical_addr into the MMIO window with the given page flags
+static void *mmio_map(uint64_t physical_addr, size_t size, uint64_t flags) {
+    // Round down physical address to page boundary
+    uint64_t phys_base = physical_addr & ~0xFFFULL;
+    uint64_t offset = physical_addr & 0xFFFULL;
+    uint64_t map_size = (size + offset + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (map_size == 0) map_size = PAGE_SIZE;
 
-    // Initialize next_mmio_addr to be just after the kernel image.
-    // We will place the MMIO region at a high, fixed virtual address
-    // to avoid any potential collision with the kernel or future allocations.
-    next_mmio_addr = 0xFFFFFFFF80000000; // Start MMIO region in the higher half
-    kprintf("MM: MMIO mapping region starts at 0x%lx\n", 0x00FF0000, next_mmio_addr);
+    // Match the physical alignment so map_range can use large pages
+    uint64_t align = PAGE_SIZE;
+    if (map_size >= PAGE_1G && cpu_has_1g_pages) align = PAGE_1G;
+    else if (map_size >= PAGE_2M) align = PAGE_2M;
+
+    uint64_t virt_base = mmio_va_alloc(map_size, phys_base, align);
+    if (!virt_base) {
+        kprintf("MM: MMIO window exhausted mapping 0x%lx (%lu bytes)\n", 0xFF0000, physical_addr, map_size);
+        return NULL;
+    }
+    kprintf("MM: Mapping MMIO addr 0x%lx to virt 0x%lx\n", 0x00FF0000, physical_addr, virt_base);
+
+    if (map_range(phys_base, virt_base, map_size / PAGE_SIZE, flags) != 0) {
+        kprintf("MM: Failed to map MMIO at 0x%lx\n", 0xFF0000, physical_addr);
+        unmap_range(virt_base, map_size / PAGE_SIZE);
+        mmio_va_free(virt_base, map_size);
+        return NULL;
+    }
+    
+    return (void*)(virt_base + offset);
 }
 
 void *mmio_remap(uint64_t physical_addr, size_t size) {
@@ -305,41 +1179,75 @@ void *mmio_remap(uint64_t physical_addr, size_t size) {
         return (void*)physical_addr;
     }
     
-    // High address - need to map pages to our MMIO virtual region
-    kprintf("MM: Mapping high MMIO addr 0x%lx to virt 0x%lx\n", 0x00FF0000, physical_addr, next_mmio_addr);
-    
-    // Round down physical address to page boundary
-    uint64_t phys_base = physical_addr & ~0xFFFULL;
-    uint64_t offset = physical_addr & 0xFFFULL;
-    
-    // Calculate number of pages needed
-    size_t pages_needed = (size + offset + PAGE_SIZE - 1) / PAGE_SIZE;
-    if (pages_needed == 0) pages_needed = 1;
-    if (pages_needed > 64) pages_needed = 64; // Limit to prevent runaway mapping
-    
-    uint64_t virt_base = next_mmio_addr;
-    
-    // Map each page
-    for (size_t i = 0; i < pages_needed; i++) {
-        uint64_t phys = phys_base + (i * PAGE_SIZE);
-        uint64_t virt = virt_base + (i * PAGE_SIZE);
-        // Map with PCD (Page Cache Disable) for MMIO
-        map_page(phys, virt, PAGE_PRESENT | PAGE_RW | PAGE_PCD);
+    // Map with PCD (Page Cache Disable) for MMIO
+    return mmio_map(physical_addr, size, PAGE_PRESENT | PAGE_RW | PAGE_PCD);
+}
+
+// Turn the 2 MiB page mapping `virt` into a page table with the same
+// physical pages and attributes, so part of it can be changed
+static int split_large_page(uint64_t virt) {
+    uint64_t *pd = walk_table(virt, 2, 0, 0);
+    if (!pd) return -1;
+    uint64_t *pde = &pd[(virt >> 21) & 0x1FF];
+    if (!(*pde & PAGE_PRESENT) || !(*pde & PAGE_HUGE)) return 0;
+
+    uint64_t pt_phys = pfa_alloc_low();
+    if (!pt_phys) return -1;
+    uint64_t *pt = phys_to_virt(pt_phys);
+    uint64_t phys = *pde & PADDR_MASK & ~(PAGE_2M - 1);
+    uint64_t flags = *pde & ~PADDR_MASK & ~(uint64_t)PAGE_HUGE;
+    if (*pde & PAGE_PAT_LARGE) flags |= PAGE_PAT;
+    for (int i = 0; i < 512; i++) pt[i] = (phys + (uint64_t)i * PAGE_SIZE) | flags;
+
+    // Same translations as before, so no TLB entry goes stale
+    *pde = pt_phys | (*pde & (PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_PWT | PAGE_PCD));
+    return 0;
+}
+
+// Remove the boot identity map's write-back alias of [phys, phys + size)
+// below 4 GiB. The 2 MiB pages at the edges are split first so whatever
+// shares them stays mapped.
+static void identity_unmap(uint64_t phys, uint64_t size) {
+    uint64_t start = phys & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (phys + size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (end > BOOT_MAPPED_LIMIT) end = BOOT_MAPPED_LIMIT;
+    if (start >= end) return;
+
+    if (((start & (PAGE_2M - 1)) && split_large_page(start) < 0) ||
+        ((end & (PAGE_2M - 1)) && split_large_page(end) < 0)) {
+        kprintf("MM: Could not split the identity map at 0x%lx\n", 0xFF0000, start);
+        return;
     }
-    
-    // Advance MMIO region pointer
-    next_mmio_addr += pages_needed * PAGE_SIZE;
-    
-    kprintf("MM: Mapped %u pages at virt 0x%lx\n", 0x00FF0000, (uint32_t)pages_needed, virt_base);
-    
-    return (void*)(virt_base + offset);
+    unmap_range(start, (end - start) / PAGE_SIZE);
+    // Lines cached through the old alias must not be written back later
+    asm volatile("wbinvd" ::: "memory");
+}
+
+void *mmio_remap_wc(uint64_t physical_addr, size_t size) {
+    // Always use the window; the identity map below 4 GiB is write-back,
+    // and mapping a page with two memory types is undefined, so that alias
+    // goes. The direct map only covers usable RAM and has none.
+    void *virt = mmio_map(physical_addr, size, PAGE_PRESENT | PAGE_RW | PAGE_WC);
+    if (virt) identity_unmap(physical_addr, size);
+    return virt;
+}
+
+void mmio_unmap(void *virt, size_t size) {
+    uint64_t addr = (uint64_t)virt;
+    if (addr < MMIO_WINDOW_START) return; // Identity-mapped, nothing to undo
+
+    uint64_t virt_base = addr & ~0xFFFULL;
+    uint64_t map_size = (size + (addr & 0xFFFULL) + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (map_size == 0) map_size = PAGE_SIZE;
+    unmap_range(virt_base, map_size / PAGE_SIZE);
+    mmio_va_free(virt_base, map_size);
 }
 
 uint64_t virt_to_phys(void* vaddr) {
     uint64_t addr = (uint64_t)vaddr;
 
     // If the address is in the higher-half direct map region, convert it.
-    if (addr >= DIRECT_MAP_OFFSET) {
+    if (addr >= DIRECT_MAP_OFFSET && addr - DIRECT_MAP_OFFSET < direct_map_end) {
         return addr - DIRECT_MAP_OFFSET;
     }
 
@@ -0,0 +1,32 @@
+#include "include/percpu.h"
+#include "include/smp.h"
+#include <stdint.h>
+
+#define MSR_GS_BASE        0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+// Static so the BSP can use its block before the allocators exist
+static percpu_t percpu_area[MAX_CPUS] __attribute__((aligned(64)));
+
+_Static_assert(offsetof(percpu_t, kernel_rsp) == PERCPU_KERNEL_RSP, "percpu layout");
+_Static_assert(offsetof(percpu_t, user_rsp) == PERCPU_USER_RSP, "percpu layout");
+_Static_assert(offsetof(percpu_t, nr_syscalls) == PERCPU_NR_SYSCALLS, "percpu layout");
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+void percpu_init(uint32_t cpu) {
+    if (cpu >= MAX_CPUS) return;
+    percpu_t *p = &percpu_area[cpu];
+    p->self = p;
+    p->cpu_id = cpu;
+    wrmsr(MSR_GS_BASE, (uint64_t)p);
+    // The value SWAPGS hands to ring 3
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+percpu_t *percpu_of(uint32_t cpu) {
+    if (cpu >= MAX_CPUS) return NULL;
+    return &percpu_area[cpu];
+}
@@ -1,21 +1,53 @@
 #include "include/sched.h"
 #include "include/autoconf.h"
+#include "include/slab.h"
+#include "include/mm.h"
+#include "include/spinlock.h"
+#include "include/smp.h"
+#include "include/percpu.h"
+#include "include/gdt.h"
+#include "include/timer.h"
+#include "include/ktimer.h"
 #include <stddef.h>
 
 extern void kprintf(const char *format, uint32_t color, ...);
 
+// switch.asm
+extern void context_switch(void **prev_rsp, void *next_rsp, void *prev_fpu, void *next_fpu);
+extern void task_entry_trampoline(void);
+
 // CPU and task pools
 static cpu_info_t cpus[MAX_CPUS];
 static int cpu_count = 0;
 
-static task_t task_pool[MAX_TASKS];
+static kmem_cache_t *task_cache;
 static int next_task_id = 0;
+static int nr_tasks = 0;
+
+// Set once the boot context has become a task and switching is allowed
+static volatile int sched_running = 0;
 
 static int smt_aware = 1;
 
 // Idle task for each CPU
 static task_t idle_tasks[MAX_CPUS];
 
+// The kernel_main/init thread of control, adopted as a task by sched_init
+static task_t boot_task;
+
+// Every live task, linked through all_next/all_prev for /proc/sched
+static task_t *all_tasks;
+static spinlock_t tasks_lock;
+
+// Top of the boot stack the boot task runs on (boot/main.asm)
+extern uint8_t stack_top[];
+
+static void sched_balance_work(work_t *work);
+static void sched_block_timeout(ktimer_t *timer);
+
+// Frames the idle loop zeroes between checks for runnable work
+#define IDLE_ZERO_BATCH 8
+
 // Custom memset
 static void *sched_memset(void *s, int c, uint32_t n) {
     unsigned char *p = s;
@@ -28,42 +60,400 @@ static void sched_strcpy(char *dest, const char *src) {
     while ((*dest++ = *src++) != '\0');
 }
 
+// Reset FPU/SSE state: x87 control word and MXCSR with all exceptions masked
+static void fpu_state_init(task_t *t) {
+    sched_memset(t->fpu_state, 0, sizeof(t->fpu_state));
+    *(uint16_t *)&t->fpu_state[0] = 0x037F;
+    *(uint32_t *)&t->fpu_state[24] = 0x1F80;
+}
+
+// Load weight per nice level (-20 .. 19). Each step changes a task's share
+// by about 10% against a task one level away.
+static const uint32_t nice_weights[SCHED_NICE_MAX - SCHED_NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,   335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
+static void task_set_nice(task_t *t, int nice) {
+    if (nice < SCHED_NICE_MIN) nice = SCHED_NICE_MIN;
+    if (nice > SCHED_NICE_MAX) nice = SCHED_NICE_MAX;
+    t->nice = nice;
+    t->weight = nice_weights[nice - SCHED_NICE_MIN];
+}
+
+static void task_list_add(task_t *t) {
+    uint64_t flags = spin_lock_irqsave(&tasks_lock);
+    t->all_prev = NULL;
+    t->all_next = all_tasks;
+    if (all_tasks) all_tasks->all_prev = t;
+    all_tasks = t;
+    spin_unlock_irqrestore(&tasks_lock, flags);
+}
+
+static void task_list_del(task_t *t) {
+    uint64_t flags = spin_lock_irqsave(&tasks_lock);
+    if (t->all_prev) t->all_prev->all_next = t->all_next;
+    else all_tasks = t->all_next;
+    if (t->all_next) t->all_next->all_prev = t->all_prev;
+    spin_unlock_irqrestore(&tasks_lock, flags);
+}
+
+// Give a task its own kernel stack, laid out so that the first
+// context_switch to it pops the callee-saved registers and returns into
+// task_entry_trampoline, which calls entry(arg).
+static int task_setup_stack(task_t *t, void (*entry)(void), void *arg) {
+    uint64_t phys = pfa_alloc_pages(TASK_STACK_ORDER);
+    if (!phys) return -1;
+    t->stack = phys_to_virt(phys);
+
+    uint64_t *sp = (uint64_t *)((uint8_t *)t->stack + TASK_STACK_SIZE);
+    *--sp = (uint64_t)task_entry_trampoline;
+    *--sp = 0;                  // rbp
+    *--sp = 0;                  // rbx
+    *--sp = (uint64_t)entry;    // r12
+    *--sp = (uint64_t)arg;      // r13
+    *--sp = 0;                  // r14
+    *--sp = 0;                  // r15
+    t->context = sp;
+    fpu_state_init(t);
+    return 0;
+}
+
+// Fair heap ordering. The signed difference keeps the order right if
+// vruntime ever wraps.
+static int fair_before(task_t *a, task_t *b) {
+    return (int64_t)(a->vruntime - b->vruntime) < 0;
+}
+
+static void heap_set(run_queue_t *rq, uint32_t i, task_t *t) {
+    rq->fair[i] = t;
+    t->heap_index = i;
+}
+
+static void heap_sift_up(run_queue_t *rq, uint32_t i) {
+    task_t *t = rq->fair[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!fair_before(t, rq->fair[parent])) break;
+        heap_set(rq, i, rq->fair[parent]);
+        i = parent;
+    }
+    heap_set(rq, i, t);
+}
+
+static void heap_sift_down(run_queue_t *rq, uint32_t i) {
+    task_t *t = rq->fair[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= rq->nr_fair) break;
+        if (child + 1 < rq->nr_fair && fair_before(rq->fair[child + 1], rq->fair[child])) child++;
+        if (!fair_before(rq->fair[child], t)) break;
+        heap_set(rq, i, rq->fair[child]);
+        i = child;
+    }
+    heap_set(rq, i, t);
+}
+
+// Take a queued fair task out of the heap from any position
+static void rq_remove_fair(cpu_info_t *cpu, task_t *t) {
+    run_queue_t *rq = &cpu->rq;
+    uint32_t i = t->heap_index;
+    task_t *last = rq->fair[--rq->nr_fair];
+    t->heap_index = -1;
+    if (last != t) {
+        heap_set(rq, i, last);
+        heap_sift_up(rq, i);
+        heap_sift_down(rq, last->heap_index);
+    }
+    rq->fair_weight -= t->weight;
+    rq->nr_running--;
+}
+
+// min_vruntime follows the smallest vruntime on the CPU, running or queued,
+// but never goes backwards
+static void update_min_vruntime(cpu_info_t *cpu) {
+    run_queue_t *rq = &cpu->rq;
+    task_t *curr = cpu->current;
+    task_t *min = NULL;
+    if (curr && curr != cpu->idle && curr->sched_class == SCHED_CLASS_FAIR &&
+        curr->state == TASK_RUNNING) min = curr;
+    if (rq->nr_fair && (!min || fair_before(rq->fair[0], min))) min = rq->fair[0];
+    if (min && (int64_t)(min->vruntime - rq->min_vruntime) > 0) rq->min_vruntime = min->vruntime;
+}
+
+// Charge the running task for the time since it was last accounted. Fair
+// tasks advance their vruntime inversely to their weight. Called with the
+// run queue locked.
+static void update_curr(cpu_info_t *cpu, uint64_t now) {
+    task_t *t = cpu->current;
+    if (!t || t == cpu->idle) return;
+    uint64_t delta = now > t->exec_start ? now - t->exec_start : 0;
+    t->exec_start = now;
+    t->sum_exec += delta;
+    if (t->sched_class == SCHED_CLASS_FAIR) {
+        t->vruntime += delta * SCHED_NICE_0_WEIGHT / t->weight;
+        update_min_vruntime(cpu);
+    }
+}
+
+// Real time a fair task may run before yielding to the others queued here:
+// its weighted share of the latency period
+static uint64_t fair_slice(cpu_info_t *cpu, task_t *t) {
+    uint64_t slice = (uint64_t)SCHED_LATENCY_US * t->weight / (cpu->rq.fair_weight + t->weight);
+    return slice < SCHED_MIN_GRANULARITY_US ? SCHED_MIN_GRANULARITY_US : slice;
+}
+
+// New tasks start at the queue's min_vruntime so they cannot monopolise
+// the CPU. A task waking from sleep gets up to half a latency period of
+// credit so interactive work runs promptly, but it cannot bank more.
+static void place_fair(cpu_info_t *cpu, task_t *t, int wakeup) {
+    uint64_t floor = cpu->rq.min_vruntime;
+    if (wakeup) floor -= SCHED_LATENCY_US / 2;
+    if (!wakeup || (int64_t)(t->vruntime - floor) < 0) t->vruntime = floor;
+}
+
+// Should t, just queued on cpu, run before that CPU's current task?
+// Priority-class tasks beat fair ones; among fair tasks only a wakeup
+// that is well behind the current task in virtual time preempts.
+static int should_preempt(cpu_info_t *cpu, task_t *t, int wakeup) {
+    task_t *curr = cpu->current;
+    if (!curr || curr == cpu->idle) return 1;
+    if (t->sched_class == SCHED_CLASS_PRIO) {
+        return curr->sched_class != SCHED_CLASS_PRIO || t->priority < curr->priority;
+    }
+    if (curr->sched_class != SCHED_CLASS_FAIR || !wakeup) return 0;
+    return (int64_t)(curr->vruntime - t->vruntime) > SCHED_WAKEUP_GRANULARITY_US;
+}
+
+// Queue a ready task: fair tasks go into the heap, priority tasks to the
+// back of their level's FIFO. IRQs must be off.
+static void rq_push(cpu_info_t *cpu, task_t *t) {
+    run_queue_t *rq = &cpu->rq;
+    t->next = NULL;
+    if (t->sched_class == SCHED_CLASS_FAIR) {
+        heap_set(rq, rq->nr_fair++, t);
+        heap_sift_up(rq, t->heap_index);
+        rq->fair_weight += t->weight;
+    } else {
+        uint32_t prio = t->priority;
+        if (rq->tail[prio]) rq->tail[prio]->next = t;
+        else rq->head[prio] = t;
+        rq->tail[prio] = t;
+        rq->bitmap |= 1u << prio;
+    }
+    rq->nr_running++;
+}
+
+// Take the first task of the highest non-empty priority, or failing that
+// the fair task with the smallest vruntime
+static task_t *rq_pop(cpu_info_t *cpu) {
+    run_queue_t *rq = &cpu->rq;
+    if (!rq->bitmap) {
+        if (!rq->nr_fair) return NULL;
+        task_t *t = rq->fair[0];
+        rq_remove_fair(cpu, t);
+        return t;
+    }
+
+    uint32_t prio;
+    __asm__("bsf %1, %0" : "=r"(prio) : "r"(rq->bitmap));
+    task_t *t = rq->head[prio];
+    rq->head[prio] = t->next;
+    if (!rq->head[prio]) {
+        rq->tail[prio] = NULL;
+        rq->bitmap &= ~(1u << prio);
+    }
+    rq->nr_running--;
+    t->next = NULL;
+    return t;
+}
+
+static uint64_t task_stack_top(task_t *t) {
+    if (!t->stack) return (uint64_t)stack_top;
+    return (uint64_t)t->stack + TASK_STACK_SIZE;
+}
+
+// Unlink a priority-class task from anywhere in its FIFO; prev_t is its
+// predecessor or NULL
+static void rq_remove(cpu_info_t *cpu, task_t *t, task_t *prev_t) {
+    run_queue_t *rq = &cpu->rq;
+    uint32_t prio = t->priority;
+    if (prev_t) prev_t->next = t->next;
+    else rq->head[prio] = t->next;
+    if (rq->tail[prio] == t) rq->tail[prio] = prev_t;
+    if (!rq->head[prio]) rq->bitmap &= ~(1u << prio);
+    rq->nr_running--;
+    t->next = NULL;
+}
+
+// Runs on the new task's stack after every switch. The previous task's
+// registers are saved now, so another CPU may pick it up; an exited task's
+// stack can finally be freed.
+static void sched_finish_switch(cpu_info_t *cpu) {
+    if (cpu->prev) {
+        __atomic_store_n(&cpu->prev->on_cpu, 0, __ATOMIC_RELEASE);
+        cpu->prev = NULL;
+    }
+
+    task_t *t = cpu->reap;
+    if (!t) return;
+    cpu->reap = NULL;
+    task_list_del(t);
+    if (t->stack) pfa_free_pages(virt_to_phys(t->stack), TASK_STACK_ORDER);
+    if (t != &boot_task) kmem_cache_free(task_cache, t);
+    __atomic_sub_fetch(&nr_tasks, 1, __ATOMIC_RELAXED);
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+// APIC ID of the CPU running this code, from CPUID leaf 1
+static uint32_t cpuid_apic_id(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return ebx >> 24;
+}
+
+// Bits needed to number n items
+static uint32_t count_bits(uint32_t n) {
+    uint32_t bits = 0;
+    while ((1u << bits) < n) bits++;
+    return bits;
+}
+
+// How APIC IDs split into thread/core/package fields, and which low bits
+// are shared by the CPUs behind one last-level cache. Hybrid parts report
+// different widths and cache sharing per core type, so every CPU runs the
+// detection itself once it is up; the BSP's result stands in until then.
+struct cpu_topology {
+    const char *source;
+    uint32_t smt_shift;     // APIC ID >> smt_shift = core
+    uint32_t pkg_shift;     // APIC ID >> pkg_shift = package
+    uint32_t llc_shift;     // APIC ID >> llc_shift = LLC domain
+    uint32_t llc_level;
+    uint32_t llc_kb;
+};
+
+static struct cpu_topology boot_topo;
+
+static void topology_detect(struct cpu_topology *topo) {
+    uint32_t a, b, c, d, max_leaf, max_ext;
+    sched_memset(topo, 0, sizeof(*topo));
+    cpuid(0, 0, &max_leaf, &b, &c, &d);
+    int amd = (b == 0x68747541); // "AuthenticAMD"
+    cpuid(0x80000000, 0, &max_ext, &b, &c, &d);
+
+    // Extended topology: each subleaf names a level (1 = SMT, 2 = core, then
+    // module/tile/die) and the APIC ID shift to the next level up
+    uint32_t leaf = 0;
+    if (max_leaf >= 0x1F) {
+        cpuid(0x1F, 0, &a, &b, &c, &d);
+        if (b) leaf = 0x1F;
+    }
+    if (!leaf && max_leaf >= 0x0B) {
+        cpuid(0x0B, 0, &a, &b, &c, &d);
+        if (b) leaf = 0x0B;
+    }
+
+    if (leaf) {
+        topo->source = leaf == 0x1F ? "CPUID.1F" : "CPUID.0B";
+        for (uint32_t sub = 0; sub < 8; sub++) {
+            cpuid(leaf, sub, &a, &b, &c, &d);
+            uint32_t type = (c >> 8) & 0xFF;
+            if (!type) break;
+            if (type == 1) topo->smt_shift = a & 0x1F;
+            topo->pkg_shift = a & 0x1F;
+        }
+    } else {
+        // Legacy: logical CPUs per package from leaf 1, cores from leaf 4
+        topo->source = "CPUID.1/4";
+        cpuid(1, 0, &a, &b, &c, &d);
+        uint32_t logical = (d & (1 << 28)) ? (b >> 16) & 0xFF : 1;
+        uint32_t cores = 1;
+        if (max_leaf >= 4) {
+            cpuid(4, 0, &a, &b, &c, &d);
+            if (a & 0x1F) cores = ((a >> 26) & 0x3F) + 1;
+        }
+        if (logical < cores) logical = cores;
+        topo->pkg_shift = count_bits(logical);
+        topo->smt_shift = count_bits(logical / cores);
+    }
+    if (topo->pkg_shift < topo->smt_shift) topo->pkg_shift = topo->smt_shift;
+
+    // Deterministic cache parameters: leaf 4 on Intel, 0x8000001D on AMD.
+    // The highest level found is the LLC; EAX[25:14] + 1 is how many APIC
+    // IDs share it.
+    uint32_t cache_leaf = 0;
+    if (amd && max_ext >= 0x8000001D) cache_leaf = 0x8000001D;
+    else if (!amd && max_leaf >= 4) cache_leaf = 4;
+
+    topo->llc_shift = topo->pkg_shift;
+    for (uint32_t sub = 0; cache_leaf && sub < 16; sub++) {
+        cpuid(cache_leaf, sub, &a, &b, &c, &d);
+        uint32_t type = a & 0x1F;
+        if (!type) break;
+        if (type == 2) continue; // Instruction cache
+        uint32_t level = (a >> 5) & 7;
+        if (level < topo->llc_level) continue;
+        topo->llc_level = level;
+        topo->llc_shift = count_bits(((a >> 14) & 0xFFF) + 1);
+        uint64_t bytes = (uint64_t)((b >> 22) + 1) * (((b >> 12) & 0x3FF) + 1) *
+                         ((b & 0xFFF) + 1) * (c + 1);
+        topo->llc_kb = bytes / 1024;
+    }
+}
+
+// Core and LLC IDs are the first APIC ID of their group rather than a
+// shifted index, so they stay comparable between CPUs whose shifts differ
+static void topology_assign(cpu_info_t *cpu, const struct cpu_topology *topo) {
+    uint32_t id = cpu->apic_id;
+    cpu->thread_id = id & ((1u << topo->smt_shift) - 1);
+    cpu->is_smt = cpu->thread_id != 0;
+    cpu->core_id = id & ~((1u << topo->smt_shift) - 1);
+    cpu->package_id = id >> topo->pkg_shift;
+    cpu->llc_id = id & ~((1u << topo->llc_shift) - 1);
+}
+
 // Detect CPUs from ACPI MADT (we already parsed this in acpi.c)
 // For now, use extern declarations to get the count
 extern int acpi_cpu_count;
 extern uint32_t acpi_cpu_apic_ids[];
 
 void sched_init(void) {
+    task_cache = kmem_cache_create("task", sizeof(task_t), 0, NULL);
+
     #ifdef CONFIG_SMP
     kprintf("SCHED: Initializing multi-core scheduler...\n", 0x00FF0000);
     
     // Initialize CPU structures
     sched_memset(cpus, 0, sizeof(cpus));
-    sched_memset(task_pool, 0, sizeof(task_pool));
     
     // Get CPU info from ACPI
     cpu_count = acpi_cpu_count > 0 ? acpi_cpu_count : 1;
     if (cpu_count > MAX_CPUS) cpu_count = MAX_CPUS;
+
+    // The MADT need not list the BSP first; CPU 0 is always the one running
+    // this code and the rest keep their MADT order.
+    uint32_t bsp_apic = cpuid_apic_id();
+    topology_detect(&boot_topo);
+    int slot = 1;
+    cpus[0].apic_id = bsp_apic;
+    for (int i = 0; i < cpu_count && acpi_cpu_count > 0; i++) {
+        if (acpi_cpu_apic_ids[i] == bsp_apic) continue;
+        if (slot >= cpu_count) break;
+        cpus[slot++].apic_id = acpi_cpu_apic_ids[i];
+    }
     
     for (int i = 0; i < cpu_count; i++) {
         cpus[i].id = i;
-        cpus[i].apic_id = acpi_cpu_apic_ids[i];
         cpus[i].is_bsp = (i == 0);
-        cpus[i].online = (i == 0); // Only BSP is online initially
-        cpus[i].run_queue = NULL;
+        cpus[i].online = (i == 0); // APs come online in smp_init
         cpus[i].current = NULL;
-        
-        // SMT detection: Assume hyperthreads have odd APIC IDs (simplified)
-        // Real detection uses CPUID leaf 0x0B
-        #ifdef CONFIG_SMT_SCHED
-        cpus[i].is_smt = (cpus[i].apic_id & 1) && (cpu_count > 1);
-        cpus[i].core_id = cpus[i].apic_id >> 1;
-        #else
-        cpus[i].is_smt = 0;
-        cpus[i].core_id = i;
-        #endif
-        
-        cpus[i].package_id = 0; // Single socket assumed
+        topology_assign(&cpus[i], &boot_topo);
         
         // Create idle task for this CPU
         idle_tasks[i].id = 0xFFFF0000 | i;
@@ -72,14 +462,16 @@ void sched_init(void) {
         sched_strcpy(idle_tasks[i].name, "idle");
     }
     
-    kprintf("SCHED: Detected %d CPU(s)\n", 0x00FF0000, cpu_count);
-    
-    #ifdef CONFIG_SMT_SCHED
     int physical_cores = 0;
     for (int i = 0; i < cpu_count; i++) {
         if (!cpus[i].is_smt) physical_cores++;
     }
-    kprintf("SCHED: SMT-aware scheduling enabled (%d physical cores)\n", 0x00FF0000, physical_cores);
+    kprintf("SCHED: Detected %d CPU(s), %d physical cores (%s, L%d %d KiB shared by %d)\n",
+            0x00FF0000, cpu_count, physical_cores, boot_topo.source, boot_topo.llc_level,
+            boot_topo.llc_kb, 1 << boot_topo.llc_shift);
+    
+    #ifdef CONFIG_SMT_SCHED
+    kprintf("SCHED: SMT-aware scheduling enabled\n", 0x00FF0000);
     #endif
     
     #else
@@ -88,7 +480,43 @@ void sched_init(void) {
     cpus[0].id = 0;
     cpus[0].is_bsp = 1;
     cpus[0].online = 1;
+    idle_tasks[0].id = 0xFFFF0000;
+    idle_tasks[0].cpu_id = 0;
+    sched_strcpy(idle_tasks[0].name, "idle");
     #endif
+
+    for (int i = 0; i < cpu_count; i++) {
+        cpus[i].idle = &idle_tasks[i];
+        work_init(&cpus[i].balance_work, sched_balance_work);
+        percpu_of(i)->cpu = &cpus[i];
+    }
+
+    // The code running now becomes the boot task; it keeps the boot stack
+    cpu_info_t *bsp = &cpus[0];
+    boot_task.id = 0;
+    boot_task.state = TASK_RUNNING;
+    boot_task.cpu_id = 0;
+    boot_task.time_slice = TASK_TIME_SLICE;
+    boot_task.priority = SCHED_PRIO_DEFAULT;
+    boot_task.sched_class = SCHED_CLASS_FAIR;
+    task_set_nice(&boot_task, 0);
+    boot_task.heap_index = -1;
+    ktimer_init(&boot_task.sleep_timer, sched_block_timeout);
+    boot_task.bound_cpu = -1;
+    boot_task.on_cpu = 1;
+    sched_strcpy(boot_task.name, "kernel");
+    fpu_state_init(&boot_task);
+    bsp->current = &boot_task;
+    percpu_write(current, &boot_task);
+    percpu_write(kernel_rsp, task_stack_top(&boot_task));
+    task_list_add(&boot_task);
+    nr_tasks = 1;
+
+    if (task_setup_stack(bsp->idle, sched_idle, NULL) < 0) {
+        kprintf("SCHED: No memory for idle stack, preemption disabled\n", 0xFF0000);
+        return;
+    }
+    sched_running = 1;
 }
 
 int sched_cpu_count(void) {
@@ -100,98 +528,571 @@ cpu_info_t *sched_get_cpu(int id) {
     return &cpus[id];
 }
 
+// Scheduling domain distance between two CPUs: 0 for SMT siblings of one
+// core, 1 for cores sharing the LLC, 2 for the same package, 3 otherwise.
+// Closer CPUs share more cache.
+static int cpu_distance(cpu_info_t *a, cpu_info_t *b) {
+    if (a->package_id != b->package_id) return 3;
+    if (a->core_id == b->core_id) return 0;
+    return a->llc_id == b->llc_id ? 1 : 2;
+}
+
+static uint32_t cpu_load(cpu_info_t *cpu) {
+    uint32_t load = cpu->rq.nr_running;
+    if (cpu->current && cpu->current != cpu->idle) load++;
+    return load;
+}
+
+// Queue a task that has just become ready on `target`, and kick that CPU
+// if the task should run before its current one
+static void sched_enqueue(task_t *t, int target, int wakeup) {
+    cpu_info_t *cpu = &cpus[target];
+    uint64_t flags = spin_lock_irqsave(&cpu->rq.lock);
+    t->cpu_id = target;
+    t->state = TASK_READY;
+    t->wait_start = timer_get_uptime_us();
+    if (t->sched_class == SCHED_CLASS_FAIR) place_fair(cpu, t, wakeup);
+    rq_push(cpu, t);
+    int kick = should_preempt(cpu, t, wakeup);
+    if (kick) cpu->need_resched = 1;
+    spin_unlock_irqrestore(&cpu->rq.lock, flags);
+    if (kick && target != (int)smp_processor_id()) smp_send_resched(target);
+}
+
+// cpu < 0 lets the scheduler place the task (and move it later);
+// otherwise it is pinned to that CPU
+static task_t *create_task(const char *name, void (*entry)(void), void *arg,
+                           uint32_t sched_class, uint32_t priority, int cpu);
+
 task_t *sched_create_task(const char *name, void (*entry)(void)) {
-    if (next_task_id >= MAX_TASKS) return NULL;
+    return create_task(name, entry, NULL, SCHED_CLASS_FAIR, SCHED_PRIO_DEFAULT, -1);
+}
+
+task_t *sched_create_task_prio(const char *name, void (*entry)(void), uint32_t priority) {
+    if (priority >= SCHED_PRIO_LEVELS) priority = SCHED_PRIO_LEVELS - 1;
+    return create_task(name, entry, NULL, SCHED_CLASS_PRIO, priority, -1);
+}
+
+task_t *kthread_create(const char *name, void (*fn)(void *), void *arg) {
+    return create_task(name, (void (*)(void))fn, arg, SCHED_CLASS_FAIR, SCHED_PRIO_DEFAULT, -1);
+}
+
+task_t *kthread_create_on_cpu(const char *name, void (*fn)(void *), void *arg, int cpu, uint32_t priority) {
+    if (cpu < 0 || cpu >= cpu_count || !cpus[cpu].online) return NULL;
+    if (priority >= SCHED_PRIO_LEVELS) priority = SCHED_PRIO_LEVELS - 1;
+    return create_task(name, (void (*)(void))fn, arg, SCHED_CLASS_PRIO, priority, cpu);
+}
+
+static task_t *create_task(const char *name, void (*entry)(void), void *arg,
+                           uint32_t sched_class, uint32_t priority, int cpu) {
+    if (__atomic_load_n(&nr_tasks, __ATOMIC_RELAXED) >= MAX_TASKS || !task_cache || !sched_running) return NULL;
     
-    task_t *t = &task_pool[next_task_id++];
-    t->id = next_task_id;
+    task_t *t = kmem_cache_alloc(task_cache);
+    if (!t) return NULL;
+    sched_memset(t, 0, sizeof(task_t));
+    if (task_setup_stack(t, entry, arg) < 0) {
+        kmem_cache_free(task_cache, t);
+        return NULL;
+    }
+    t->id = __atomic_add_fetch(&next_task_id, 1, __ATOMIC_RELAXED);
     t->state = TASK_READY;
-    t->time_slice = 10; // Default time slice
+    t->time_slice = TASK_TIME_SLICE;
     t->total_runtime = 0;
+    t->priority = priority;
+    t->sched_class = sched_class;
+    task_set_nice(t, 0);
+    t->heap_index = -1;
+    ktimer_init(&t->sleep_timer, sched_block_timeout);
+    t->bound_cpu = cpu;
     sched_strcpy(t->name, name);
+
+    __atomic_add_fetch(&nr_tasks, 1, __ATOMIC_RELAXED);
+    task_list_add(t);
+
+    if (cpu >= 0) {
+        sched_enqueue(t, cpu, 0);
+        kprintf("SCHED: Created task '%s' (ID %d) bound to CPU %d\n", 0x00FFFF00, name, t->id, cpu);
+        return t;
+    }
     
-    // Assign to least loaded CPU
+    // Placement: the least busy physical core first (so work spreads over
+    // cores before doubling up on hyperthreads), then the least busy CPU,
+    // and on a tie stay in the creator's LLC so related tasks share cache.
+    cpu_info_t *self = percpu_read(cpu);
     int target_cpu = 0;
-    int min_load = 0x7FFFFFFF;
+    uint32_t best = 0xFFFFFFFF;
     
     for (int i = 0; i < cpu_count; i++) {
-        if (!cpus[i].online) continue;
+        cpu_info_t *c = &cpus[i];
+        if (!c->online) continue;
         
+        uint32_t core_load = 0;
         #ifdef CONFIG_SMT_SCHED
-        // Prefer physical cores over hyperthreads if smt_aware
-        if (smt_aware && cpus[i].is_smt) continue;
+        if (smt_aware) {
+            for (int j = 0; j < cpu_count; j++) {
+                if (cpus[j].online && cpu_distance(&cpus[j], c) == 0) core_load += cpu_load(&cpus[j]);
+            }
+        }
         #endif
         
-        // Count tasks in run queue
-        int load = 0;
-        task_t *q = cpus[i].run_queue;
-        while (q) { load++; q = q->next; }
-        
-        if (load < min_load) {
-            min_load = load;
+        uint32_t score = (core_load << 16) | (cpu_load(c) << 1) | (c->llc_id != self->llc_id);
+        if (score < best) {
+            best = score;
             target_cpu = i;
         }
     }
     
-    t->cpu_id = target_cpu;
-    
-    // Add to run queue
-    t->next = cpus[target_cpu].run_queue;
-    cpus[target_cpu].run_queue = t;
+    sched_enqueue(t, target_cpu, 0);
     
     kprintf("SCHED: Created task '%s' (ID %d) on CPU %d\n", 0x00FFFF00, name, t->id, target_cpu);
     
     return t;
 }
 
+// Take the coldest migratable task from src: highest priority level first,
+// oldest entry first, skipping tasks still being switched out. Called with
+// both queues locked.
+static task_t *rq_steal_one(cpu_info_t *src) {
+    uint32_t bits = src->rq.bitmap;
+    while (bits) {
+        uint32_t prio;
+        __asm__("bsf %1, %0" : "=r"(prio) : "r"(bits));
+        bits &= ~(1u << prio);
+
+        task_t *prev_t = NULL;
+        for (task_t *t = src->rq.head[prio]; t; prev_t = t, t = t->next) {
+            if (__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE) || t->bound_cpu >= 0) continue;
+            rq_remove(src, t, prev_t);
+            return t;
+        }
+    }
+
+    // Fair tasks: heap leaves sit near the end of the array and have the
+    // largest vruntime, so they are the least urgent to run here
+    for (int i = (int)src->rq.nr_fair - 1; i >= 0; i--) {
+        task_t *t = src->rq.fair[i];
+        if (__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE) || t->bound_cpu >= 0) continue;
+        rq_remove_fair(src, t);
+        return t;
+    }
+    return NULL;
+}
+
+// Pull one task onto dst from the busiest CPU, looking at SMT siblings
+// first, then cores sharing the LLC, then the package, then everything. A CPU is only robbed if that
+// leaves it at least as loaded as dst. Returns 1 if a task moved.
+static int sched_steal(cpu_info_t *dst) {
+    #ifdef CONFIG_SMT_SCHED
+    // With SMT awareness an idle hyperthread whose sibling is busy leaves
+    // work to CPUs on cores that are entirely idle, if there are any
+    if (smt_aware && dst->current == dst->idle) {
+        int sibling_busy = 0, idle_core = 0;
+        for (int i = 0; i < cpu_count; i++) {
+            cpu_info_t *c = &cpus[i];
+            if (c == dst || !c->online) continue;
+            if (cpu_distance(c, dst) == 0) {
+                if (cpu_load(c)) sibling_busy = 1;
+            } else if (!c->is_smt && cpu_load(c) == 0) {
+                int core_idle = 1;
+                for (int j = 0; j < cpu_count; j++) {
+                    if (cpus[j].online && cpu_distance(&cpus[j], c) == 0 && cpu_load(&cpus[j])) core_idle = 0;
+                }
+                if (core_idle) idle_core = 1;
+            }
+        }
+        if (sibling_busy && idle_core) return 0;
+    }
+    #endif
+
+    uint32_t dst_load = cpu_load(dst);
+    for (int dist = 0; dist <= 3; dist++) {
+        cpu_info_t *busiest = NULL;
+        uint32_t most = dst_load + 1;
+        for (int i = 0; i < cpu_count; i++) {
+            cpu_info_t *c = &cpus[i];
+            if (c == dst || !c->online || cpu_distance(c, dst) != dist) continue;
+            uint32_t load = cpu_load(c);
+            if (load > most && c->rq.nr_running) {
+                most = load;
+                busiest = c;
+            }
+        }
+        if (!busiest) continue;
+
+        // Lock in CPU order so two CPUs stealing from each other cannot deadlock
+        cpu_info_t *first = dst->id < busiest->id ? dst : busiest;
+        cpu_info_t *second = first == dst ? busiest : dst;
+        uint64_t flags = spin_lock_irqsave(&first->rq.lock);
+        spin_lock(&second->rq.lock);
+
+        task_t *t = NULL;
+        if (cpu_load(busiest) > cpu_load(dst) + 1) t = rq_steal_one(busiest);
+        if (t) {
+            t->cpu_id = dst->id;
+            // vruntime is relative to each queue's min_vruntime
+            if (t->sched_class == SCHED_CLASS_FAIR) {
+                t->vruntime = t->vruntime - busiest->rq.min_vruntime + dst->rq.min_vruntime;
+            }
+            rq_push(dst, t);
+            busiest->nr_migrations_out++;
+            dst->nr_migrations_in++;
+        }
+
+        spin_unlock(&second->rq.lock);
+        spin_unlock_irqrestore(&first->rq.lock, flags);
+        if (t) return 1;
+    }
+    return 0;
+}
+
+// Send a resched IPI to one idle CPU so it tries to steal from `from`,
+// preferring the closest in the topology
+static void sched_kick_idle(cpu_info_t *from) {
+    cpu_info_t *best = NULL;
+    for (int i = 0; i < cpu_count; i++) {
+        cpu_info_t *c = &cpus[i];
+        if (c == from || !c->online || c->current != c->idle || c->need_resched) continue;
+        if (!best || cpu_distance(c, from) < cpu_distance(best, from)) best = c;
+    }
+    if (best) {
+        best->need_resched = 1;
+        smp_send_resched(best->id);
+    }
+}
+
+// Periodic balancing pass of a busy CPU
+static void sched_balance(cpu_info_t *cpu) {
+    sched_steal(cpu);
+    // Idle CPUs have no tick to balance from, so wake one of them up
+    // to pull from us when we have work queued
+    if (cpu->rq.nr_running) sched_kick_idle(cpu);
+}
+
+static void sched_balance_work(work_t *work) {
+    sched_balance((cpu_info_t *)((uint8_t *)work - offsetof(cpu_info_t, balance_work)));
+}
+
 void sched_yield(void) {
-    // Placeholder: In real implementation, this would save context and call schedule
     sched_schedule();
 }
 
-void sched_schedule(void) {
-    // Simple round-robin on BSP for now
-    cpu_info_t *cpu = &cpus[0];
-    
-    if (!cpu->run_queue) {
-        cpu->current = &idle_tasks[0];
+void sched_set_nice(task_t *t, int nice) {
+    // The task can be stolen between reading cpu_id and taking the lock
+    for (;;) {
+        cpu_info_t *cpu = &cpus[__atomic_load_n(&t->cpu_id, __ATOMIC_RELAXED)];
+        uint64_t flags = spin_lock_irqsave(&cpu->rq.lock);
+        if (t->cpu_id != cpu->id) {
+            spin_unlock_irqrestore(&cpu->rq.lock, flags);
+            continue;
+        }
+        if (t->heap_index >= 0) cpu->rq.fair_weight -= t->weight;
+        task_set_nice(t, nice);
+        if (t->heap_index >= 0) cpu->rq.fair_weight += t->weight;
+        spin_unlock_irqrestore(&cpu->rq.lock, flags);
         return;
     }
-    
-    // Round-robin: Move current to end, pick next
-    task_t *next = cpu->run_queue;
-    if (next->state == TASK_READY) {
-        cpu->current = next;
-        cpu->run_queue = next->next;
-        next->next = NULL;
-        
-        // Add back to end of queue
-        if (cpu->run_queue) {
-            task_t *tail = cpu->run_queue;
-            while (tail->next) tail = tail->next;
-            tail->next = next;
+}
+
+void sched_wake_task(task_t *t) {
+    uint32_t expected = TASK_BLOCKED;
+    if (!t || !__atomic_compare_exchange_n(&t->state, &expected, TASK_READY, 0,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return;
+    // Before the scheduler runs there are no queues: the task only ever
+    // halted, so it is running again already
+    if (!sched_running) {
+        t->state = TASK_RUNNING;
+        return;
+    }
+    sched_enqueue(t, t->cpu_id, 1);
+}
+
+int sched_can_block(void) {
+    if (!sched_running) return 0;
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0" : "=r"(flags));
+    if (!(flags & (1 << 9))) return 0;
+    cpu_info_t *cpu = percpu_read(cpu);
+    return cpu->current != cpu->idle;
+}
+
+// The deadline of a timed block passed
+static void sched_block_timeout(ktimer_t *timer) {
+    sched_wake_task((task_t *)((uint8_t *)timer - offsetof(task_t, sleep_timer)));
+}
+
+void sched_block(uint64_t deadline_us) {
+    if (!sched_can_block()) {
+        // Nothing to switch to: wait for an interrupt instead. A task that
+        // woke itself up already (state no longer blocked) must not halt.
+        task_t *t = sched_running ? percpu_read(current) : NULL;
+        uint64_t flags = local_irq_save();
+        if (deadline_us) timer_request_wakeup(deadline_us);
+        if ((flags & (1 << 9)) && (!t || t->state == TASK_BLOCKED)) {
+            __asm__ volatile("sti; hlt");
         } else {
-            cpu->run_queue = next;
+            local_irq_restore(flags);
+            __asm__ volatile("pause");
         }
+        return;
     }
+
+    task_t *t = percpu_read(current);
+    if (deadline_us) timer_add(&t->sleep_timer, deadline_us * 1000);
+    sched_schedule();
+    // Woken by an event before the deadline. Wait out a timeout callback
+    // already running elsewhere, so it cannot wake the task's next block.
+    if (deadline_us) timer_cancel_sync(&t->sleep_timer);
 }
 
+// Undo TASK_BLOCKED on the calling task. If a waker got there first the
+// task is already queued; yield once so that queue entry is consumed
+// rather than left behind.
+void sched_cancel_block(void) {
+    task_t *t = percpu_read(current);
+    if (!t) return;
+    uint32_t expected = TASK_BLOCKED;
+    if (__atomic_compare_exchange_n(&t->state, &expected, TASK_RUNNING, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return;
+    if (t->state == TASK_READY) sched_schedule();
+}
+
+void sched_sleep_us(uint64_t us) {
+    uint64_t deadline = timer_get_uptime_us() + us;
+    while (timer_get_uptime_us() < deadline) {
+        task_t *t = percpu_read(current);
+        if (t) t->state = TASK_BLOCKED;
+        sched_block(deadline);
+        sched_cancel_block();
+    }
+}
+
+// Switch to the next ready task on this CPU, or its idle task if there is
+// none. The current task is queued again unless it is idle, blocked or
+// exiting. A preempted task is queued even if it had just marked itself
+// blocked: it was interrupted between setting the state and checking its
+// wait condition, and would otherwise miss a wakeup that came first.
+static void schedule(int preempt) {
+    if (!sched_running) return;
+
+    uint64_t flags = local_irq_save();
+    cpu_info_t *cpu = percpu_read(cpu);
+    task_t *prev = cpu->current;
+    uint64_t now = timer_get_uptime_us();
+
+    spin_lock(&cpu->rq.lock);
+    update_curr(cpu, now);
+    if (prev != cpu->idle &&
+        (prev->state == TASK_RUNNING || (preempt && prev->state == TASK_BLOCKED))) {
+        prev->state = TASK_READY;
+        prev->wait_start = now;
+        rq_push(cpu, prev);
+    }
+
+    task_t *next = rq_pop(cpu);
+    spin_unlock(&cpu->rq.lock);
+    // About to go idle: try to take work from a busier CPU first
+    if (!next && sched_steal(cpu)) {
+        spin_lock(&cpu->rq.lock);
+        next = rq_pop(cpu);
+        spin_unlock(&cpu->rq.lock);
+    }
+    if (!next) next = cpu->idle;
+    next->state = TASK_RUNNING;
+    next->time_slice = TASK_TIME_SLICE;
+    if (next != cpu->idle) {
+        next->wait_time += now > next->wait_start ? now - next->wait_start : 0;
+        next->exec_start = now;
+        next->slice_start = next->sum_exec;
+    }
+    cpu->need_resched = 0;
+
+    if (next != prev) {
+        // The tick is stopped while idle; restart it for the new task
+        if (prev == cpu->idle) {
+            cpu->idle_time += timer_get_uptime_us() - cpu->idle_since;
+            timer_tick_start();
+        } else if (next == cpu->idle) {
+            cpu->idle_since = timer_get_uptime_us();
+        }
+        next->on_cpu = 1;
+        next->nr_scheduled++;
+        cpu->prev = prev;
+        cpu->current = next;
+        percpu_write(current, next);
+        percpu_inc(nr_switches);
+        // Entry from ring 3 (SYSCALL or an interrupt) lands on next's stack
+        uint64_t top = task_stack_top(next);
+        percpu_write(kernel_rsp, top);
+        gdt_set_kernel_stack(cpu->id, top);
+        context_switch(&prev->context, next->context, prev->fpu_state, next->fpu_state);
+        // Back on prev's stack, possibly much later
+        sched_finish_switch(percpu_read(cpu));
+    }
+    local_irq_restore(flags);
+}
+
+void sched_schedule(void) {
+    schedule(0);
+}
+
+// First thing a new task runs (from task_entry_trampoline). It arrives
+// here with interrupts disabled, as sched_schedule left them.
+void sched_task_start(void) {
+    sched_finish_switch(percpu_read(cpu));
+    __asm__ volatile("sti");
+}
+
+void sched_exit(void) {
+    __asm__ volatile("cli");
+    cpu_info_t *cpu = percpu_read(cpu);
+    task_t *t = cpu->current;
+    t->state = TASK_ZOMBIE;
+    cpu->reap = t;
+    kprintf("SCHED: Task '%s' (ID %d) exited\n", 0x00FFFF00, t->name, t->id);
+    sched_schedule();
+    for (;;) __asm__ volatile("hlt");
+}
+
+// Called from the timer interrupt. Only accounts and flags the CPU; the
+// switch itself happens in sched_preempt once the handler has sent EOI.
 void sched_tick(void) {
-    // Called from timer interrupt
-    for (int i = 0; i < cpu_count; i++) {
-        if (!cpus[i].online) continue;
-        
-        task_t *current = cpus[i].current;
-        if (current && current->time_slice > 0) {
-            current->time_slice--;
-            current->total_runtime++;
-            
-            if (current->time_slice == 0) {
-                current->time_slice = 10; // Reset slice
-                // Trigger reschedule (simplified)
-            }
+    if (!sched_running) return;
+
+    cpu_info_t *cpu = percpu_read(cpu);
+    task_t *current = cpu->current;
+
+    if (current == cpu->idle) {
+        if (cpu->rq.nr_running || sched_steal(cpu)) cpu->need_resched = 1;
+        return;
+    }
+
+    if (++cpu->balance_ticks >= SCHED_BALANCE_INTERVAL) {
+        cpu->balance_ticks = 0;
+        // Balancing looks at every CPU's queue; keep it out of the interrupt
+        if (schedule_work(&cpu->balance_work) < 0) sched_balance(cpu);
+    }
+
+    current->total_runtime++;
+    spin_lock(&cpu->rq.lock);
+    update_curr(cpu, timer_get_uptime_us());
+    if (current->sched_class == SCHED_CLASS_FAIR) {
+        // Queued priority-class work always goes first; otherwise give way
+        // once the task has used its share of the latency period
+        if (cpu->rq.bitmap) cpu->need_resched = 1;
+        else if (cpu->rq.nr_fair &&
+                 current->sum_exec - current->slice_start >= fair_slice(cpu, current)) {
+            cpu->need_resched = 1;
         }
+    } else {
+        if (current->time_slice > 0) current->time_slice--;
+        if (current->time_slice == 0) cpu->need_resched = 1;
+    }
+    spin_unlock(&cpu->rq.lock);
+}
+
+void sched_preempt(void) {
+    if (!sched_running) return;
+    cpu_info_t *cpu = percpu_read(cpu);
+    if (cpu->need_resched) schedule(1);
+}
+
+// One slice of background work for an idle CPU. Returns nonzero if
+// anything was done, so callers know whether halting is worthwhile.
+int sched_idle_work(void) {
+    return pfa_zero_idle(IDLE_ZERO_BATCH);
+}
+
+// Body of the per-CPU idle task: do background work while there is any,
+// otherwise stop the tick and halt until something else wakes the CPU
+// (a resched IPI, a sleep deadline or a device interrupt).
+void sched_idle(void) {
+    for (;;) {
+        if (sched_idle_work()) continue;
+
+        __asm__ volatile("cli");
+        cpu_info_t *cpu = percpu_read(cpu);
+        if (cpu->rq.nr_running || cpu->need_resched) {
+            __asm__ volatile("sti");
+            sched_schedule();
+            continue;
+        }
+        timer_tick_stop();
+        __asm__ volatile("sti; hlt");
+    }
+}
+
+uint64_t sched_prepare_cpu(int id) {
+    if (id <= 0 || id >= cpu_count) return 0;
+    task_t *idle = cpus[id].idle;
+    if (!idle->stack) {
+        uint64_t phys = pfa_alloc_pages(TASK_STACK_ORDER);
+        if (!phys) return 0;
+        idle->stack = phys_to_virt(phys);
+        fpu_state_init(idle);
+    }
+    return (uint64_t)idle->stack + TASK_STACK_SIZE;
+}
+
+// Runs on the AP, on its idle stack: the code already executing is the idle
+// task, so it is current from the start and gets saved on the first switch.
+void sched_cpu_online(int id) {
+    cpu_info_t *cpu = &cpus[id];
+
+    // This CPU's own view of the topology, before others can see it online
+    struct cpu_topology topo;
+    topology_detect(&topo);
+    topology_assign(cpu, &topo);
+    if (topo.smt_shift != boot_topo.smt_shift || topo.llc_shift != boot_topo.llc_shift) {
+        kprintf("SCHED: CPU %d: SMT shift %u, L%u %u KiB shared by %u (differs from the BSP)\n",
+                0x00FF0000, id, topo.smt_shift, topo.llc_level, topo.llc_kb, 1u << topo.llc_shift);
+    }
+    cpu->idle->state = TASK_RUNNING;
+    cpu->idle->on_cpu = 1;
+    cpu->current = cpu->idle;
+    percpu_write(current, cpu->idle);
+    percpu_write(kernel_rsp, task_stack_top(cpu->idle));
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+}
+
+int sched_format_cpuinfo(char *buf, int size) {
+    extern int sprintf(char *buf, const char *fmt, ...);
+    int len = 0;
+    for (int i = 0; i < cpu_count; i++) {
+        cpu_info_t *cpu = &cpus[i];
+        if (size - len < 400) break;
+        task_t *cur = cpu->current;
+        percpu_t *pc = percpu_of(i);
+        len += sprintf(buf + len,
+                       "processor: %d\napic_id: %d\npackage_id: %d\ncore_id: %d\nthread_id: %d\n"
+                       "llc_id: %d\nonline: %s\n"
+                       "running: %s\nqueued: %d\nidle_us: %lu\n"
+                       "migrations_in: %lu\nmigrations_out: %lu\n"
+                       "context_switches: %lu\nirqs: %lu\nsyscalls: %lu\n\n",
+                       i, cpu->apic_id, cpu->package_id, cpu->core_id, cpu->thread_id,
+                       cpu->llc_id,
+                       cpu->online ? "yes" : "no", cur ? cur->name : "-",
+                       cpu->rq.nr_running, cpu->idle_time,
+                       cpu->nr_migrations_in, cpu->nr_migrations_out,
+                       pc->nr_switches, pc->nr_irqs, pc->nr_syscalls);
+    }
+    return len;
+}
+
+int sched_format_tasks(char *buf, int size) {
+    extern int sprintf(char *buf, const char *fmt, ...);
+    static const char *states[] = { "running", "ready", "blocked", "zombie" };
+    int len = sprintf(buf, "id cpu class nice prio state runtime_us wait_us switches vruntime name\n");
+
+    uint64_t flags = spin_lock_irqsave(&tasks_lock);
+    for (task_t *t = all_tasks; t; t = t->all_next) {
+        if (size - len < 200) break;
+        len += sprintf(buf + len, "%u %u %s %d %u %s %lu %lu %lu %lu %s\n",
+                       t->id, t->cpu_id, t->sched_class == SCHED_CLASS_FAIR ? "fair" : "prio",
+                       t->nice, t->priority, t->state <= TASK_ZOMBIE ? states[t->state] : "?",
+                       t->sum_exec, t->wait_time, t->nr_scheduled, t->vruntime, t->name);
     }
+    spin_unlock_irqrestore(&tasks_lock, flags);
+    return len;
 }
 
 void sched_set_smt_aware(int enabled) {
@@ -0,0 +1,281 @@
+#include "include/slab.h"
+#include "include/mm.h"
+#include "include/spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Forward declaration for kprintf
+extern void kprintf(const char *format, uint32_t color, ...);
+
+#define PAGE_SIZE 4096
+#define SLAB_MAGIC 0x51AB51AB
+
+// Slabs are naturally aligned PFA blocks with this header in their first
+// bytes, so the owning slab of any object is found by masking its address.
+// Objects therefore never start on a page boundary, which is how kfree
+// tells size-class objects from page-sized allocations.
+struct slab {
+    uint32_t magic;
+    uint32_t inuse;
+    kmem_cache_t *cache;
+    void *freelist;          // First free object
+    struct slab *next;
+    struct slab *prev;
+};
+
+struct kmem_cache {
+    spinlock_t lock;         // Protects the slab lists and counters
+    char name[32];
+    size_t obj_size;
+    uint32_t slab_order;
+    uint32_t objs_per_slab;
+    uint32_t first_offset;   // Offset of object 0 from the slab base
+    uint32_t link_offset;    // Where a free object keeps its free-list link
+    void (*ctor)(void *obj);
+    struct slab *partial;
+    struct slab *full;
+    struct slab *free;
+    uint32_t nr_slabs;
+    uint32_t nr_free_slabs;
+    uint64_t nr_active;
+};
+
+// Aim for at least this many objects per slab, up to SLAB_MAX_ORDER
+#define SLAB_MIN_OBJS  8
+#define SLAB_MAX_ORDER 3
+// Empty slabs kept per cache before pages go back to the PFA
+#define SLAB_KEEP_FREE 1
+
+// kmalloc size classes
+#define KMALLOC_MIN_SHIFT 4   // 16 bytes
+#define KMALLOC_MAX_SHIFT 10  // 1 KiB
+#define KMALLOC_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+static kmem_cache_t cache_cache; // Cache the kmem_cache structures come from
+static kmem_cache_t *kmalloc_caches[KMALLOC_CLASSES];
+static const char *kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+};
+
+static void slab_memset(void *s, int c, size_t n) {
+    uint8_t *p = s;
+    while (n--) *p++ = (uint8_t)c;
+}
+
+static void slab_list_add(struct slab **head, struct slab *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_list_del(struct slab **head, struct slab *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static void cache_setup(kmem_cache_t *cache, const char *name, size_t size,
+                        size_t align, uint32_t max_order, void (*ctor)(void *)) {
+    slab_memset(cache, 0, sizeof(*cache));
+    int i = 0;
+    while (name[i] && i < 31) { cache->name[i] = name[i]; i++; }
+    cache->name[i] = '\0';
+
+    if (align < 16) align = 16;
+    if (size < sizeof(void *)) size = sizeof(void *);
+    // A free object normally stores its link in its first word. Constructed
+    // objects must keep their state while free, so the link goes after them.
+    if (ctor) {
+        size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        cache->link_offset = size;
+        size += sizeof(void *);
+    }
+    size = (size + align - 1) & ~(align - 1);
+    cache->obj_size = size;
+    cache->ctor = ctor;
+    cache->first_offset = (sizeof(struct slab) + align - 1) & ~(align - 1);
+
+    uint32_t order = 0;
+    while (order < max_order &&
+           (((size_t)PAGE_SIZE << order) - cache->first_offset) / size < SLAB_MIN_OBJS) {
+        order++;
+    }
+    cache->slab_order = order;
+    cache->objs_per_slab = (((size_t)PAGE_SIZE << order) - cache->first_offset) / size;
+}
+
+static struct slab *slab_grow(kmem_cache_t *cache) {
+    uint64_t phys = pfa_alloc_pages(cache->slab_order);
+    if (!phys) return NULL;
+
+    struct slab *slab = (struct slab *)phys_to_virt(phys);
+    slab->magic = SLAB_MAGIC;
+    slab->inuse = 0;
+    slab->cache = cache;
+    slab->next = slab->prev = NULL;
+
+    // Thread the free list through the objects, lowest address first
+    uint8_t *base = (uint8_t *)slab + cache->first_offset;
+    slab->freelist = NULL;
+    for (int i = (int)cache->objs_per_slab - 1; i >= 0; i--) {
+        uint8_t *obj = base + (size_t)i * cache->obj_size;
+        if (cache->ctor) cache->ctor(obj);
+        *(void **)(obj + cache->link_offset) = slab->freelist;
+        slab->freelist = obj;
+    }
+
+    cache->nr_slabs++;
+    return slab;
+}
+
+static void slab_release(kmem_cache_t *cache, struct slab *slab) {
+    slab->magic = 0;
+    cache->nr_slabs--;
+    pfa_free_pages(virt_to_phys(slab), cache->slab_order);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *obj)) {
+    if (!name || size == 0 || size > ((size_t)PAGE_SIZE << SLAB_MAX_ORDER) / 2) return NULL;
+    if (align & (align - 1)) return NULL;
+
+    kmem_cache_t *cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) return NULL;
+    cache_setup(cache, name, size, align, SLAB_MAX_ORDER, ctor);
+    return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    struct slab *slab = cache->partial;
+    if (!slab) {
+        slab = cache->free;
+        if (slab) {
+            slab_list_del(&cache->free, slab);
+            cache->nr_free_slabs--;
+        } else {
+            slab = slab_grow(cache);
+            if (!slab) {
+                spin_unlock_irqrestore(&cache->lock, flags);
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    uint8_t *obj = slab->freelist;
+    slab->freelist = *(void **)(obj + cache->link_offset);
+    slab->inuse++;
+    cache->nr_active++;
+
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!obj) return;
+    uint64_t slab_bytes = (uint64_t)PAGE_SIZE << cache->slab_order;
+    struct slab *slab = (struct slab *)((uint64_t)obj & ~(slab_bytes - 1));
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+        kprintf("SLAB: bad free of 0x%lx to cache %s\n", 0xFF0000, (uint64_t)obj, cache->name);
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    *(void **)((uint8_t *)obj + cache->link_offset) = slab->freelist;
+    slab->freelist = obj;
+    slab->inuse--;
+    cache->nr_active--;
+
+    if (slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+        if (cache->nr_free_slabs < SLAB_KEEP_FREE) {
+            slab_list_add(&cache->free, slab);
+            cache->nr_free_slabs++;
+        } else {
+            slab_release(cache, slab);
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+void kmem_cache_shrink(kmem_cache_t *cache) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    while (cache->free) {
+        struct slab *slab = cache->free;
+        slab_list_del(&cache->free, slab);
+        cache->nr_free_slabs--;
+        slab_release(cache, slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+void *kmalloc(size_t size) {
+    if (size == 0) return NULL;
+
+    if (size > ((size_t)1 << KMALLOC_MAX_SHIFT)) {
+        uint32_t order = pfa_order_for_size(size);
+        uint64_t phys = pfa_alloc_pages(order);
+        return phys ? phys_to_virt(phys) : NULL;
+    }
+
+    int idx = 0;
+    while (((size_t)1 << (idx + KMALLOC_MIN_SHIFT)) < size) idx++;
+    if (!kmalloc_caches[idx]) return NULL;
+    return kmem_cache_alloc(kmalloc_caches[idx]);
+}
+
+void *kzalloc(size_t size) {
+    void *p = kmalloc(size);
+    if (p) slab_memset(p, 0, size);
+    return p;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) return;
+    uint64_t addr = (uint64_t)ptr;
+
+    if ((addr & (PAGE_SIZE - 1)) == 0) {
+        // Page-aligned: a large allocation straight from the buddy allocator
+        uint64_t phys = virt_to_phys(ptr);
+        pfa_free_pages(phys, pfa_block_order(phys));
+        return;
+    }
+
+    struct slab *slab = (struct slab *)(addr & ~(uint64_t)(PAGE_SIZE - 1));
+    if (slab->magic != SLAB_MAGIC) {
+        kprintf("SLAB: kfree of unknown pointer 0x%lx\n", 0xFF0000, addr);
+        return;
+    }
+    kmem_cache_free(slab->cache, ptr);
+}
+
+void slab_init(void) {
+    cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, SLAB_MAX_ORDER, NULL);
+
+    // kfree finds the slab by rounding down to the page, so the size
+    // classes always use single-page slabs.
+    for (int i = 0; i < KMALLOC_CLASSES; i++) {
+        kmem_cache_t *cache = kmem_cache_alloc(&cache_cache);
+        if (!cache) {
+            kprintf("SLAB: failed to create %s\n", 0xFF0000, kmalloc_names[i]);
+            continue;
+        }
+        cache_setup(cache, kmalloc_names[i], (size_t)1 << (i + KMALLOC_MIN_SHIFT), 0, 0, NULL);
+        kmalloc_caches[i] = cache;
+    }
+    kprintf("SLAB: %d kmalloc size classes (%d - %d bytes)\n", 0x00FF0000,
+            KMALLOC_CLASSES, 1 << KMALLOC_MIN_SHIFT, 1 << KMALLOC_MAX_SHIFT);
+}
@@ -0,0 +1,205 @@
+#include "include/smp.h"
+#include "include/sched.h"
+#include "include/lapic.h"
+#include "include/gdt.h"
+#include "include/idt.h"
+#include "include/mm.h"
+#include "include/io.h"
+#include "include/percpu.h"
+#include "include/timer.h"
+#include "include/irq.h"
+#include "include/spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Forward declaration for kprintf
+extern void kprintf(const char *format, uint32_t color, ...);
+
+// ap_trampoline.asm
+extern uint8_t ap_trampoline_start[], ap_trampoline_end[];
+extern uint8_t ap_tramp_cr3[], ap_tramp_efer[], ap_tramp_stack[], ap_tramp_entry[], ap_tramp_cpu[];
+
+// Top of the BSP boot stack (boot/main.asm)
+extern uint8_t stack_top[];
+
+#define MSR_EFER  0xC0000080
+#define EFER_LMA  (1 << 10)
+
+static int online_cpus = 1;
+static volatile int ap_started;
+
+// Each write to the POST port takes about a microsecond. Interrupts are
+// still off during bring-up, so the PIT tick count cannot be used.
+static void smp_udelay(uint32_t us) {
+    while (us--) io_wait();
+}
+
+// Write one of the ap_tramp_* parameters in the low-memory copy
+static void tramp_set(uint8_t *param, uint64_t value) {
+    uint8_t *copy = phys_to_virt(AP_TRAMPOLINE_ADDR);
+    *(volatile uint64_t *)(copy + (param - ap_trampoline_start)) = value;
+}
+
+// First C code on an AP, running on its idle stack with the BSP's page
+// tables and the trampoline's GDT.
+static void ap_main(uint32_t cpu) {
+    percpu_init(cpu);
+    cpu_info_t *info = sched_get_cpu(cpu);
+    gdt_init_cpu(cpu, (uint64_t)info->idle->stack + TASK_STACK_SIZE);
+    idt_load();
+    mm_pat_init();
+    lapic_cpu_init();
+    timer_clockevents_init_cpu();
+
+    kprintf("SMP: CPU %d (APIC ID %d) online\n", 0x00FF0000, cpu, info->apic_id);
+    sched_cpu_online(cpu);
+    __atomic_store_n(&ap_started, 1, __ATOMIC_RELEASE);
+
+    sched_idle();
+}
+
+static int smp_start_ap(int cpu, uint32_t apic_id) {
+    uint64_t stack = sched_prepare_cpu(cpu);
+    if (!stack) {
+        kprintf("SMP: No memory for CPU %d stack\n", 0xFFFF0000, cpu);
+        return -1;
+    }
+    tramp_set(ap_tramp_stack, stack);
+    tramp_set(ap_tramp_cpu, cpu);
+    ap_started = 0;
+
+    // INIT, wait 10 ms, then up to two STARTUPs 200 us apart
+    lapic_send_init(apic_id);
+    smp_udelay(10000);
+    for (int sipi = 0; sipi < 2 && !ap_started; sipi++) {
+        lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDR >> 12);
+        smp_udelay(200);
+    }
+
+    // Give a slow AP up to a second to reach ap_main
+    for (int i = 0; i < 1000000 && !__atomic_load_n(&ap_started, __ATOMIC_ACQUIRE); i++) {
+        io_wait();
+    }
+    return ap_started ? 0 : -1;
+}
+
+void smp_init(void) {
+    int count = sched_cpu_count();
+
+    // The BSP moves to its own GDT/TSS too, so every CPU has the same layout
+    gdt_init_cpu(0, (uint64_t)stack_top);
+
+    if (lapic_init() < 0) return;
+    // With the local APIC up, device IRQs can go through the I/O APIC
+    irq_init();
+    // APs have no tick of their own without a working LAPIC timer
+    if (timer_clockevents_init() < 0) {
+        kprintf("SMP: No LAPIC timer, not starting APs\n", 0xFFFF0000);
+        return;
+    }
+    if (count <= 1) {
+        kprintf("SMP: Single CPU, no APs to start\n", 0x00FF0000);
+        return;
+    }
+
+    uint64_t cr3, efer;
+    uint32_t lo, hi;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_EFER));
+    efer = ((uint64_t)hi << 32) | lo;
+    if (cr3 >> 32) {
+        kprintf("SMP: PML4 above 4 GiB, cannot start APs\n", 0xFFFF0000);
+        return;
+    }
+
+    uint64_t size = ap_trampoline_end - ap_trampoline_start;
+    uint8_t *copy = phys_to_virt(AP_TRAMPOLINE_ADDR);
+    for (uint64_t i = 0; i < size; i++) copy[i] = ap_trampoline_start[i];
+    tramp_set(ap_tramp_cr3, cr3);
+    tramp_set(ap_tramp_efer, efer & ~(uint64_t)EFER_LMA);
+    tramp_set(ap_tramp_entry, (uint64_t)ap_main);
+
+    for (int cpu = 1; cpu < count; cpu++) {
+        uint32_t apic_id = sched_get_cpu(cpu)->apic_id;
+        if (smp_start_ap(cpu, apic_id) == 0) {
+            online_cpus++;
+        } else {
+            kprintf("SMP: CPU %d (APIC ID %d) did not start\n", 0xFFFF0000, cpu, apic_id);
+        }
+    }
+    kprintf("SMP: %d of %d CPUs online\n", 0x00FF0000, online_cpus, count);
+}
+
+int smp_online_cpus(void) {
+    return online_cpus;
+}
+
+// TLB shootdown. The initiator publishes the request, sends the IPI and
+// waits until every target has cleared its bit in tlb_pending. Only one
+// request is out at a time; a CPU waiting for its turn answers the current
+// one itself, since with interrupts off it would never see the IPI.
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+static const uint64_t *tlb_addrs;
+static uint32_t tlb_count;
+static int tlb_full;
+static uint64_t tlb_pending;
+
+static void tlb_shootdown_ack(void) {
+    uint64_t bit = 1ULL << smp_processor_id();
+    if (!(__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) & bit)) return;
+    mm_tlb_invalidate(tlb_addrs, tlb_count, tlb_full);
+    __atomic_fetch_and(&tlb_pending, ~bit, __ATOMIC_RELEASE);
+}
+
+int smp_tlb_shootdown(const uint64_t *addrs, uint32_t count, int full) {
+    int ncpus = sched_cpu_count();
+    if (ncpus <= 1) return 0;
+
+    uint64_t flags = local_irq_save();
+    while (!spin_trylock(&tlb_lock)) {
+        tlb_shootdown_ack();
+        __asm__ volatile("pause");
+    }
+
+    uint32_t self = smp_processor_id();
+    uint64_t targets = 0;
+    for (int cpu = 0; cpu < ncpus; cpu++) {
+        cpu_info_t *info = sched_get_cpu(cpu);
+        if ((uint32_t)cpu != self && __atomic_load_n(&info->online, __ATOMIC_ACQUIRE)) {
+            targets |= 1ULL << cpu;
+        }
+    }
+
+    if (targets) {
+        tlb_addrs = addrs;
+        tlb_count = count;
+        tlb_full = full;
+        __atomic_store_n(&tlb_pending, targets, __ATOMIC_RELEASE);
+        for (int cpu = 0; cpu < ncpus; cpu++) {
+            if (targets & (1ULL << cpu)) lapic_send_ipi(sched_get_cpu(cpu)->apic_id, IPI_TLB_VECTOR);
+        }
+        while (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE)) __asm__ volatile("pause");
+    }
+
+    spin_unlock(&tlb_lock);
+    local_irq_restore(flags);
+    return targets != 0;
+}
+
+void smp_send_resched(uint32_t cpu) {
+    cpu_info_t *info = sched_get_cpu(cpu);
+    if (info && info->online) lapic_send_ipi(info->apic_id, IPI_RESCHED_VECTOR);
+}
+
+// IPI handlers, called from the isr.asm stubs. The resched stub calls
+// sched_preempt on the way out.
+void smp_ipi_tlb(void) {
+    percpu_inc(nr_irqs);
+    tlb_shootdown_ack();
+    lapic_eoi();
+}
+
+void smp_ipi_resched(void) {
+    percpu_inc(nr_irqs);
+    lapic_eoi();
+}
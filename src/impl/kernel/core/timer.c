@@ -2,6 +2,13 @@
 #include "include/io.h"
 #include "include/idt.h"
 #include "include/stdio.h"
+#include "include/sched.h"
+#include "include/smp.h"
+#include "include/lapic.h"
+#include "include/spinlock.h"
+#include "include/hpet.h"
+#include "include/ktimer.h"
+#include "include/irq.h"
 #include <stdint.h>
 
 // Forward declaration for kprintf
@@ -16,16 +23,345 @@ extern void kprintf(const char *format, uint32_t color, ...);
 // PIT frequency
 #define PIT_BASE_FREQ 1193182  // Hz
 
+// PIT channel 2 is gated through port 0x61; OUT2 reads back in bit 5
+#define PIT_GATE_PORT 0x61
+
+// Calibration windows, timed by the HPET if there is one, else PIT channel 2
+#define CALIBRATE_MS 10
+#define CALIBRATE_RUNS 3
+
 // Global state
 static volatile uint64_t g_timer_ticks = 0;
 static uint32_t g_timer_frequency = 0;
 
-// PIT IRQ handler (IRQ0)
+// Clock source: the TSC, calibrated at boot, if it runs at a constant
+// rate. Cycles convert to nanoseconds as (cycles * tsc_mult) >> TSC_SHIFT,
+// so reading the time takes no division. Without a usable TSC a 64-bit
+// HPET counter is the clock source instead; until then, or without
+// either, time comes from the PIT tick count.
+#define TSC_SHIFT 32
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_mult = 0;
+static uint64_t tsc_boot = 0;   // TSC value at uptime 0
+static int hpet_clock = 0;
+static uint64_t hpet_boot = 0;  // HPET counter at uptime 0
+
+// Clock events: once calibrated, each CPU drives its own scheduler tick from
+// its LAPIC timer and the PIT is only used for calibration. With a TSC or
+// HPET clock source the timer runs in one-shot (or TSC-deadline) mode: the
+// tick only runs while the CPU has a task, and an idle CPU programs its next
+// wakeup, if any, and otherwise stops its timer completely. Without one the
+// timer is periodic and the BSP's interrupt counts uptime as the PIT did.
+static int clockevents_ready = 0;
+static int clock_mode = LAPIC_TIMER_ONESHOT;
+static uint32_t lapic_ticks_per_ms = 0;  // Measured on the BSP
+static uint64_t tick_us = 0;
+
+// An AP whose LAPIC timer rate is this close to the BSP's (in 1/1000s)
+// takes the BSP's more precise measurement
+#define CALIBRATE_AP_TOLERANCE 10
+
+struct cpu_clock {
+    int ticking;
+    uint32_t ticks_per_ms;  // LAPIC timer rate of this CPU
+    uint64_t next_tick_us;  // When sched_tick is next due
+    uint64_t wakeup_us;     // Earliest requested wakeup (timer wheel, idle sleeps), 0 if none
+};
+static struct cpu_clock cpu_clocks[MAX_CPUS];
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+uint64_t timer_read_cycles(void) {
+    return rdtsc();
+}
+
+uint64_t timer_cycles_to_ns(uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * tsc_mult) >> TSC_SHIFT);
+}
+
+// Program this CPU's timer for whichever of its tick and wakeup is due
+// first, or stop it if neither is. IRQs must be off.
+static void clock_reprogram(struct cpu_clock *cc, uint64_t now) {
+    uint64_t next = 0;
+    if (cc->ticking) next = cc->next_tick_us;
+    if (cc->wakeup_us && (!next || cc->wakeup_us < next)) next = cc->wakeup_us;
+
+    if (!next) {
+        lapic_timer_stop();
+        return;
+    }
+
+    uint64_t delta = next > now ? next - now : 1;
+    if (clock_mode == LAPIC_TIMER_TSC_DEADLINE) {
+        lapic_timer_deadline(rdtsc() + delta * (tsc_hz / 1000000));
+    } else {
+        uint64_t count = delta * cc->ticks_per_ms / 1000;
+        if (count == 0) count = 1;
+        if (count > 0xFFFFFFFF) count = 0xFFFFFFFF;
+        lapic_timer_oneshot((uint32_t)count);
+    }
+}
+
+// LAPIC timer interrupt
+void timer_event_interrupt(void) {
+    percpu_inc(nr_irqs);
+    uint32_t cpu = smp_processor_id();
+    struct cpu_clock *cc = &cpu_clocks[cpu];
+
+    if (clock_mode == LAPIC_TIMER_PERIODIC) {
+        if (cpu == 0) g_timer_ticks++;
+        sched_tick();
+        timer_wheel_run(timer_get_uptime_ns());
+        lapic_eoi();
+        return;
+    }
+
+    uint64_t now = timer_get_uptime_us();
+
+    if (cc->ticking && now >= cc->next_tick_us) {
+        sched_tick();
+        cc->next_tick_us = now + tick_us;
+    }
+    if (cc->wakeup_us && now >= cc->wakeup_us) cc->wakeup_us = 0;
+    timer_wheel_run(timer_get_uptime_ns());
+
+    lapic_eoi();
+    clock_reprogram(cc, now);
+}
+
+// The scheduler calls these when a CPU leaves or enters its idle task.
+// Both run with interrupts disabled.
+void timer_tick_start(void) {
+    if (!clockevents_ready || clock_mode == LAPIC_TIMER_PERIODIC) return;
+    struct cpu_clock *cc = &cpu_clocks[smp_processor_id()];
+    if (cc->ticking) return;
+    uint64_t now = timer_get_uptime_us();
+    cc->ticking = 1;
+    cc->next_tick_us = now + tick_us;
+    clock_reprogram(cc, now);
+}
+
+void timer_tick_stop(void) {
+    if (!clockevents_ready || clock_mode == LAPIC_TIMER_PERIODIC) return;
+    struct cpu_clock *cc = &cpu_clocks[smp_processor_id()];
+    if (!cc->ticking) return;
+    cc->ticking = 0;
+    clock_reprogram(cc, timer_get_uptime_us());
+}
+
+// A periodic tick reaches every deadline by itself
+void timer_request_wakeup(uint64_t deadline_us) {
+    if (!clockevents_ready || clock_mode == LAPIC_TIMER_PERIODIC) return;
+    uint64_t flags = local_irq_save();
+    struct cpu_clock *cc = &cpu_clocks[smp_processor_id()];
+    if (!cc->wakeup_us || deadline_us < cc->wakeup_us) {
+        cc->wakeup_us = deadline_us;
+        clock_reprogram(cc, timer_get_uptime_us());
+    }
+    local_irq_restore(flags);
+}
+
+// Start a PIT channel 2 countdown of `ms` milliseconds without interrupts
+static void pit_gate_start(uint32_t ms) {
+    uint32_t count = PIT_BASE_FREQ * ms / 1000;
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01); // Gate on, speaker off
+    outb(PIT_COMMAND, 0xB0);  // Channel 2, lobyte/hibyte, mode 0
+    outb(PIT_CHANNEL2, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL2, (uint8_t)((count >> 8) & 0xFF));
+}
+
+static int pit_gate_expired(void) {
+    return inb(PIT_GATE_PORT) & 0x20;
+}
+
+// Start a calibration window and report when it has ended. The HPET is
+// read directly and has no port I/O latency, so it gives the tighter bound.
+static uint64_t ref_start;
+static uint64_t ref_ticks;
+
+static void ref_window_start(void) {
+    if (hpet_available()) {
+        ref_ticks = hpet_frequency() * CALIBRATE_MS / 1000;
+        ref_start = hpet_read_counter();
+    } else {
+        pit_gate_start(CALIBRATE_MS);
+    }
+}
+
+static int ref_window_expired(void) {
+    if (hpet_available()) {
+        return ((hpet_read_counter() - ref_start) & hpet_counter_mask()) >= ref_ticks;
+    }
+    return pit_gate_expired();
+}
+
+// TSC cycles (and optionally LAPIC timer ticks) across one calibration
+// window. IRQs must be off.
+static uint64_t ref_measure(uint32_t *lapic_elapsed) {
+    ref_window_start();
+    if (lapic_elapsed) lapic_timer_oneshot(0xFFFFFFFF);
+    uint64_t start = rdtsc();
+    while (!ref_window_expired()) __asm__ volatile("pause");
+    uint64_t end = rdtsc();
+    if (lapic_elapsed) {
+        *lapic_elapsed = 0xFFFFFFFF - lapic_timer_current();
+        lapic_timer_stop();
+    }
+    return end - start;
+}
+
+// The TSC can be a clock source if its rate does not change with P-states
+// or stop in C-states: the invariant TSC bit, or any TSC a hypervisor
+// provides (those are kept constant for the guest)
+static const char *tsc_stability(void) {
+    uint32_t a, b, c, d, max_ext;
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & (1 << 4))) return NULL;
+    int hypervisor = c & (1u << 31);
+    cpuid(0x80000000, &max_ext, &b, &c, &d);
+    if (max_ext >= 0x80000007) {
+        cpuid(0x80000007, &a, &b, &c, &d);
+        if (d & (1 << 8)) return "invariant";
+    }
+    return hypervisor ? "virtual" : NULL;
+}
+
+// Fall back to the HPET main counter when the TSC cannot be trusted. A
+// 32-bit counter wraps within minutes, so only a 64-bit one will do.
+static void hpet_clocksource_init(void) {
+    if (!hpet_available() || hpet_counter_mask() != ~0ULL) {
+        kprintf("TIMER: No invariant TSC, time keeps PIT tick resolution\n", 0xFFFF0000);
+        return;
+    }
+    uint64_t flags = local_irq_save();
+    hpet_boot = hpet_read_counter() - g_timer_ticks * (hpet_frequency() / g_timer_frequency);
+    __atomic_store_n(&hpet_clock, 1, __ATOMIC_RELEASE);
+    local_irq_restore(flags);
+    kprintf("TIMER: HPET clock source, %lu kHz\n", 0x00FF0000, hpet_frequency() / 1000);
+}
+
+void timer_clocksource_init(void) {
+    if (g_timer_frequency == 0) return;
+    const char *kind = tsc_stability();
+    if (!kind) {
+        hpet_clocksource_init();
+        return;
+    }
+
+    // An SMI or emulation exit during a run only makes it longer, so the
+    // shortest run is the most accurate
+    uint64_t flags = local_irq_save();
+    uint64_t best = ~0ULL;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t cycles = ref_measure(NULL);
+        if (cycles < best) best = cycles;
+    }
+    uint64_t hz = best * (1000 / CALIBRATE_MS);
+    if (hz < 1000000) {
+        local_irq_restore(flags);
+        kprintf("TIMER: TSC calibration failed\n", 0xFFFF0000);
+        hpet_clocksource_init();
+        return;
+    }
+
+    // Carry the uptime already counted by the PIT over to the TSC
+    tsc_mult = ((uint64_t)1000000000 << TSC_SHIFT) / hz;
+    tsc_boot = rdtsc() - g_timer_ticks * (hz / g_timer_frequency);
+    __atomic_store_n(&tsc_hz, hz, __ATOMIC_RELEASE);
+    local_irq_restore(flags);
+
+    kprintf("TIMER: TSC clock source, %lu kHz (%s, %s reference)\n", 0x00FF0000,
+            hz / 1000, kind, hpet_available() ? "HPET" : "PIT");
+}
+
+// LAPIC timer ticks per millisecond over `runs` calibration windows,
+// keeping the shortest. IRQs must be off.
+static uint32_t lapic_calibrate(int runs) {
+    lapic_timer_setup(LAPIC_TIMER_ONESHOT);
+    uint32_t best = 0xFFFFFFFF;
+    for (int i = 0; i < runs; i++) {
+        uint32_t elapsed;
+        ref_measure(&elapsed);
+        if (elapsed < best) best = elapsed;
+    }
+    return best / CALIBRATE_MS;
+}
+
+// Measure the LAPIC timer rate against the HPET or PIT, then move the
+// calling CPU (the BSP) from the PIT tick to its LAPIC timer. Requires
+// lapic_init; with a TSC or HPET clock source the timer is one-shot,
+// otherwise periodic.
+int timer_clockevents_init(void) {
+    if (g_timer_frequency == 0) return -1;
+
+    uint64_t flags = local_irq_save();
+    lapic_ticks_per_ms = lapic_calibrate(CALIBRATE_RUNS);
+    if (lapic_ticks_per_ms == 0) {
+        kprintf("TIMER: LAPIC timer calibration failed, keeping the PIT tick\n", 0xFFFF0000);
+        local_irq_restore(flags);
+        return -1;
+    }
+
+    tick_us = 1000000 / g_timer_frequency;
+    if (tsc_hz && lapic_has_tsc_deadline()) clock_mode = LAPIC_TIMER_TSC_DEADLINE;
+    else if (tsc_hz || hpet_clock) clock_mode = LAPIC_TIMER_ONESHOT;
+    else clock_mode = LAPIC_TIMER_PERIODIC;
+
+    kprintf("TIMER: LAPIC timer %u kHz, %s\n", 0x00FF0000, lapic_ticks_per_ms,
+            clock_mode == LAPIC_TIMER_TSC_DEADLINE ? "TSC-deadline mode, tickless idle" :
+            clock_mode == LAPIC_TIMER_ONESHOT ? "one-shot mode, tickless idle" :
+            "periodic mode (no TSC or HPET clock source)");
+
+    // The PIT is only a calibration reference from here on: mask IRQ0
+    irq_mask(0);
+    cpu_clocks[smp_processor_id()].ticks_per_ms = lapic_ticks_per_ms;
+    __atomic_store_n(&clockevents_ready, 1, __ATOMIC_RELEASE);
+    timer_clockevents_init_cpu();
+    local_irq_restore(flags);
+    return 0;
+}
+
+// Switch the calling CPU to its LAPIC timer. APs call this as they start,
+// one at a time, and measure their own timer against the BSP's first.
+void timer_clockevents_init_cpu(void) {
+    if (!clockevents_ready) return;
+    uint32_t cpu = smp_processor_id();
+    struct cpu_clock *cc = &cpu_clocks[cpu];
+
+    if (cpu != 0 && clock_mode != LAPIC_TIMER_TSC_DEADLINE) {
+        uint32_t rate = lapic_calibrate(1);
+        uint32_t diff = rate > lapic_ticks_per_ms ? rate - lapic_ticks_per_ms : lapic_ticks_per_ms - rate;
+        if (rate == 0 || (uint64_t)diff * 1000 <= (uint64_t)lapic_ticks_per_ms * CALIBRATE_AP_TOLERANCE) {
+            cc->ticks_per_ms = lapic_ticks_per_ms;
+        } else {
+            cc->ticks_per_ms = rate;
+            kprintf("TIMER: CPU %d LAPIC timer runs at %u kHz (BSP %u kHz)\n", 0xFFFF0000,
+                    cpu, rate, lapic_ticks_per_ms);
+        }
+    }
+
+    lapic_timer_setup(clock_mode);
+    if (clock_mode == LAPIC_TIMER_PERIODIC) {
+        lapic_timer_periodic((uint32_t)(cc->ticks_per_ms * tick_us / 1000));
+    } else {
+        timer_tick_start();
+    }
+}
+
+// PIT IRQ handler (IRQ0). The BSP's tick until its LAPIC timer takes over
+// (for good without a usable LAPIC, and then there are no APs either).
 void timer_irq_handler(void) {
     g_timer_ticks++;
-    
-    // Send EOI (End of Interrupt) to PIC
-    outb(0x20, 0x20);  // Master PIC EOI
+    sched_tick();
+    timer_wheel_run(timer_get_uptime_ns());
 }
 
 void pit_init(uint32_t frequency_hz) {
@@ -64,20 +400,74 @@ void pit_init(uint32_t frequency_hz) {
     kprintf("TIMER: PIT configured successfully\n", 0x00FF0000);
 }
 
+uint64_t timer_get_uptime_ns(void) {
+    if (tsc_hz) return timer_cycles_to_ns(rdtsc() - tsc_boot);
+    if (hpet_clock) return hpet_ticks_to_ns(hpet_read_counter() - hpet_boot);
+    if (g_timer_frequency == 0) return 0;
+    return g_timer_ticks * 1000000000 / g_timer_frequency;
+}
+
+uint64_t timer_get_uptime_us(void) {
+    return timer_get_uptime_ns() / 1000;
+}
+
 uint64_t timer_get_ticks(void) {
+    if (tsc_hz || hpet_clock) return timer_get_uptime_ns() / (1000000000 / g_timer_frequency);
     return g_timer_ticks;
 }
 
 uint64_t timer_get_uptime_ms(void) {
-    if (g_timer_frequency == 0) return 0;
-    return (g_timer_ticks * 1000) / g_timer_frequency;
+    return timer_get_uptime_ns() / 1000000;
 }
 
 uint32_t timer_get_frequency(void) {
     return g_timer_frequency;
 }
 
+void timer_udelay(uint32_t us) {
+    if (!tsc_hz) {
+        if (hpet_available()) {
+            hpet_ndelay((uint64_t)us * 1000);
+            return;
+        }
+        while (us--) io_wait();
+        return;
+    }
+    uint64_t end = rdtsc() + (uint64_t)us * (tsc_hz / 1000000);
+    while (rdtsc() < end) __asm__ volatile("pause");
+}
+
+void timer_sleep_us(uint64_t us) {
+    // Tasks block and leave the CPU to others
+    if (sched_can_block()) {
+        sched_sleep_us(us);
+        return;
+    }
+
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0" : "=r"(flags));
+
+    // Nothing would wake a halted CPU with interrupts off, and without a
+    // clock event device there is no way to ask for a wakeup
+    if (!(flags & (1 << 9)) || !clockevents_ready) {
+        timer_udelay(us);
+        return;
+    }
+
+    uint64_t deadline = timer_get_uptime_us() + us;
+    while (timer_get_uptime_us() < deadline) {
+        __asm__ volatile("cli");
+        timer_request_wakeup(deadline);
+        __asm__ volatile("sti; hlt");
+    }
+}
+
 void timer_sleep_ms(uint32_t ms) {
+    if (clockevents_ready || sched_can_block()) {
+        timer_sleep_us((uint64_t)ms * 1000);
+        return;
+    }
+
     if (g_timer_frequency == 0) {
         // Fallback: busy wait
         for (volatile uint64_t i = 0; i < (uint64_t)ms * 100000; i++);
@@ -86,7 +476,7 @@ void timer_sleep_ms(uint32_t ms) {
 
     uint64_t target_ticks = g_timer_ticks + ((uint64_t)ms * g_timer_frequency / 1000);
     
-    // Busy wait for now (will be replaced with scheduler sleep later)
+    // Early boot: nothing to switch to, so halt until each PIT tick
     while (g_timer_ticks < target_ticks) {
         __asm__ volatile("hlt");  // Halt until next interrupt
     }
@@ -0,0 +1,54 @@
+#include "include/wait.h"
+#include "include/sched.h"
+#include "include/percpu.h"
+#include <stddef.h>
+
+void wait_queue_init(wait_queue_t *wq) {
+    wq->lock.locked = 0;
+    wq->head = NULL;
+}
+
+void wake_up(wait_queue_t *wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    task_t *t = wq->head;
+    wq->head = NULL;
+    while (t) {
+        task_t *next = t->wait_next;
+        t->wait_next = NULL;
+        t->wait_queued = 0;
+        sched_wake_task(t);
+        t = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// The state change happens under the queue lock, so wake_up either sees
+// the task blocked or runs before it was queued (and the caller's
+// re-check of its condition catches that case).
+void wait_prepare(wait_queue_t *wq) {
+    task_t *t = percpu_read(current);
+    if (!t) return; // Before sched_init: sched_block just halts
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    if (!t->wait_queued) {
+        t->wait_next = wq->head;
+        wq->head = t;
+        t->wait_queued = 1;
+    }
+    t->state = TASK_BLOCKED;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_finish(wait_queue_t *wq) {
+    task_t *t = percpu_read(current);
+    if (!t) return;
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    if (t->wait_queued) {
+        task_t **pp = &wq->head;
+        while (*pp && *pp != t) pp = &(*pp)->wait_next;
+        if (*pp) *pp = t->wait_next;
+        t->wait_next = NULL;
+        t->wait_queued = 0;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    sched_cancel_block();
+}
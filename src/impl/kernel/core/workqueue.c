@@ -0,0 +1,114 @@
+#include "include/workqueue.h"
+#include "include/wait.h"
+#include "include/sched.h"
+#include "include/smp.h"
+#include "include/spinlock.h"
+#include <stddef.h>
+
+extern void kprintf(const char *format, uint32_t color, ...);
+
+struct cpu_workqueue {
+    spinlock_t lock;
+    work_t *head, *tail;        // FIFO of pending items
+    wait_queue_t wait;          // The worker sleeps here while the FIFO is empty
+    task_t *worker;
+    uint64_t nr_queued;
+    uint64_t nr_executed;
+    uint64_t nr_batches;        // Worker wakeups that found work
+};
+
+static struct cpu_workqueue workqueues[MAX_CPUS];
+
+static void worker_main(void *arg) {
+    struct cpu_workqueue *wq = arg;
+    for (;;) {
+        wait_event(&wq->wait, wq->head != NULL);
+
+        // Take everything queued so far in one go; items queued while
+        // this batch runs make up the next one
+        uint64_t flags = spin_lock_irqsave(&wq->lock);
+        work_t *work = wq->head;
+        wq->head = wq->tail = NULL;
+        spin_unlock_irqrestore(&wq->lock, flags);
+
+        while (work) {
+            work_t *next = work->next;
+            work->next = NULL;
+            // Cleared first so the function may queue its item again
+            __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+            work->fn(work);
+            wq->nr_executed++;
+            work = next;
+        }
+        wq->nr_batches++;
+    }
+}
+
+void workqueue_init(void) {
+    extern int sprintf(char *buf, const char *fmt, ...);
+    int started = 0;
+    for (int cpu = 0; cpu < sched_cpu_count(); cpu++) {
+        struct cpu_workqueue *wq = &workqueues[cpu];
+        wq->lock.locked = 0;
+        wq->head = wq->tail = NULL;
+        wait_queue_init(&wq->wait);
+        if (!sched_get_cpu(cpu)->online) continue;
+
+        char name[16];
+        sprintf(name, "kworker/%d", cpu);
+
+        task_t *t = kthread_create_on_cpu(name, worker_main, wq, cpu, WORKQUEUE_PRIO);
+        if (!t) {
+            kprintf("WORKQUEUE: Could not start a worker on CPU %d\n", 0xFFFF0000, cpu);
+            continue;
+        }
+        __atomic_store_n(&wq->worker, t, __ATOMIC_RELEASE);
+        started++;
+    }
+    kprintf("WORKQUEUE: %d worker thread(s) started\n", 0x00FF0000, started);
+}
+
+int schedule_work_on(int cpu, work_t *work) {
+    if (cpu < 0 || cpu >= MAX_CPUS) return -1;
+    struct cpu_workqueue *wq = &workqueues[cpu];
+    if (!__atomic_load_n(&wq->worker, __ATOMIC_ACQUIRE)) {
+        // No worker on that CPU: any CPU that has one will do
+        wq = &workqueues[0];
+        if (!__atomic_load_n(&wq->worker, __ATOMIC_ACQUIRE)) return -1;
+    }
+
+    uint32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&work->pending, &expected, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return 0;
+
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    int was_empty = wq->head == NULL;
+    work->next = NULL;
+    if (wq->tail) wq->tail->next = work;
+    else wq->head = work;
+    wq->tail = work;
+    wq->nr_queued++;
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    // The worker drains the whole FIFO per wakeup, so only the first item
+    // of a batch needs to wake it
+    if (was_empty) wake_up(&wq->wait);
+    return 1;
+}
+
+int schedule_work(work_t *work) {
+    return schedule_work_on(smp_processor_id(), work);
+}
+
+int workqueue_format_stats(char *buf, int size) {
+    extern int sprintf(char *buf, const char *fmt, ...);
+    int len = 0;
+    for (int cpu = 0; cpu < sched_cpu_count(); cpu++) {
+        struct cpu_workqueue *wq = &workqueues[cpu];
+        if (!wq->worker) continue;
+        if (size - len < 120) break;
+        len += sprintf(buf + len, "cpu%d: queued %lu executed %lu batches %lu\n",
+                       cpu, wq->nr_queued, wq->nr_executed, wq->nr_batches);
+    }
+    return len;
+}
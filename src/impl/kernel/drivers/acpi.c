@@ -116,6 +116,11 @@ static int g_cpu_count = 0;
 int acpi_cpu_count = 0;
 uint32_t acpi_cpu_apic_ids[64] = {0};
 
+// Exported for the I/O APIC driver; overrides are indexed by ISA IRQ
+int acpi_ioapic_count = 0;
+struct acpi_ioapic_info acpi_ioapics[ACPI_MAX_IOAPICS];
+struct acpi_irq_override acpi_irq_overrides[16];
+
 // --------------------------------------------------------------------------
 // ACPI Table Search
 // --------------------------------------------------------------------------
@@ -250,6 +255,11 @@ void acpi_parse_madt(void) {
 
             case MADT_TYPE_IO_APIC: {
                 struct madt_io_apic *ioapic = (struct madt_io_apic *)entry;
+                if (io_apic_count < ACPI_MAX_IOAPICS) {
+                    acpi_ioapics[io_apic_count].id = ioapic->io_apic_id;
+                    acpi_ioapics[io_apic_count].address = ioapic->io_apic_address;
+                    acpi_ioapics[io_apic_count].gsi_base = ioapic->global_system_interrupt_base;
+                }
                 io_apic_count++;
                 kprintf("ACPI: I/O APIC #%d at 0x%lx, GSI base: %d\n",
                         0x00FFFF00, ioapic->io_apic_id, 
@@ -260,6 +270,11 @@ void acpi_parse_madt(void) {
 
             case MADT_TYPE_INTERRUPT_OVERRIDE: {
                 struct madt_interrupt_override *override = (struct madt_interrupt_override *)entry;
+                if (override->bus == 0 && override->source < 16) { // ISA
+                    acpi_irq_overrides[override->source].present = 1;
+                    acpi_irq_overrides[override->source].gsi = override->global_system_interrupt;
+                    acpi_irq_overrides[override->source].flags = override->flags;
+                }
                 kprintf("ACPI: IRQ Override - Source: %d -> GSI: %d, flags: 0x%x\n",
                         0x00FFFF00, override->source, override->global_system_interrupt,
                         override->flags);
@@ -272,6 +287,7 @@ void acpi_parse_madt(void) {
 
     g_cpu_count = cpu_count;
     acpi_cpu_count = cpu_count;
+    acpi_ioapic_count = io_apic_count < ACPI_MAX_IOAPICS ? io_apic_count : ACPI_MAX_IOAPICS;
     kprintf("ACPI: Detected %d CPU(s), %d I/O APIC(s)\n", 0x00FF0000, cpu_count, io_apic_count);
 }
 
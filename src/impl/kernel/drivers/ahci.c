@@ -2,6 +2,7 @@
 #include "include/vray.h"
 #include "include/mm.h"
 #include "include/stdio.h"
+#include "include/timer.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -135,6 +136,17 @@ typedef struct {
 #define ATA_CMD_WRITE_DMA_EX    0x35
 #define ATA_CMD_IDENTIFY        0xEC
 
+// Command completion: give up after a second, check every 50 us
+#define AHCI_CMD_TIMEOUT_US 1000000
+#define AHCI_POLL_US        50
+
+// The spec allows the command engine 500 ms to stop
+#define AHCI_ENGINE_TIMEOUT_US 500000
+#define AHCI_ENGINE_POLL_US    10
+
+// Host capabilities
+#define AHCI_CAP_S64A       (1U << 31) // Supports 64-bit addressing
+
 // Port Commands
 #define HBA_PORT_CMD_ST     0x0001
 #define HBA_PORT_CMD_FRE    0x0010
@@ -176,18 +188,16 @@ static void port_stop_cmd(ahci_hba_port_t *port) {
     port->cmd &= ~HBA_PORT_CMD_FRE;
     
     // Wait until FR (FIS receive running) and CR (Command list running) are cleared
-    int timeout = 100000;
-    while (timeout-- > 0) {
-        if ((port->cmd & HBA_PORT_CMD_FR) == 0 && (port->cmd & HBA_PORT_CMD_CR) == 0)
-            break;
+    if (!timer_poll_until((port->cmd & (HBA_PORT_CMD_FR | HBA_PORT_CMD_CR)) == 0,
+                          AHCI_ENGINE_TIMEOUT_US, AHCI_ENGINE_POLL_US)) {
+        kprintf("AHCI: Command engine did not stop\n", 0xFFFF0000);
     }
 }
 
 // Start command engine
 static void port_start_cmd(ahci_hba_port_t *port) {
     // Wait until CR (command list running) is cleared
-    int timeout = 100000;  
-    while ((port->cmd & HBA_PORT_CMD_CR) != 0 && timeout-- > 0);
+    timer_poll_until((port->cmd & HBA_PORT_CMD_CR) == 0, AHCI_ENGINE_TIMEOUT_US, AHCI_ENGINE_POLL_US);
     
     port->cmd |= HBA_PORT_CMD_FRE;
     port->cmd |= HBA_PORT_CMD_ST;
@@ -203,6 +213,25 @@ static int find_cmdslot(ahci_hba_port_t *port) {
     return -1;
 }
 
+// Wait for the command in `slot` to complete. The HBA's interrupt is not
+// routed, so the caller polls, sleeping between checks so the CPU can run
+// other tasks while the transfer is in flight.
+static int port_wait_complete(ahci_hba_port_t *port, int slot, const char *what) {
+    uint64_t deadline = timer_get_uptime_us() + AHCI_CMD_TIMEOUT_US;
+    while (port->ci & (1 << slot)) {
+        if (port->is & (1 << 30)) { // Task file error
+            kprintf("AHCI: Task file error\n", 0xFFFF0000);
+            return -1;
+        }
+        if (timer_get_uptime_us() >= deadline) {
+            kprintf("AHCI: %s timeout\n", 0xFFFF0000, what);
+            return -1;
+        }
+        timer_sleep_us(AHCI_POLL_US);
+    }
+    return 0;
+}
+
 // Read sectors from port
 static int port_read(ahci_hba_port_t *port, uint64_t lba, uint32_t count, uint8_t *buffer) {
     port->is = (uint32_t)-1; // Clear pending interrupts
@@ -214,19 +243,24 @@ static int port_read(ahci_hba_port_t *port, uint64_t lba, uint32_t count, uint8_
     }
     
     // Get command list (physical address stored in port->clb)
-    ahci_cmd_header_t *cmdheader = (ahci_cmd_header_t*)(uintptr_t)(uint64_t)port->clb;
+    ahci_cmd_header_t *cmdheader = (ahci_cmd_header_t*)phys_to_virt(((uint64_t)port->clbu << 32) | port->clb);
     cmdheader += slot;
     cmdheader->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
     cmdheader->w = 0; // Read
     cmdheader->prdtl = 1;
     
     // Command table (physical address)
-    ahci_cmd_table_t *cmdtbl = (ahci_cmd_table_t*)(uintptr_t)(uint64_t)cmdheader->ctba;
+    ahci_cmd_table_t *cmdtbl = (ahci_cmd_table_t*)phys_to_virt(((uint64_t)cmdheader->ctbau << 32) | cmdheader->ctba);
     custom_memset(cmdtbl, 0, sizeof(ahci_cmd_table_t));
     
     // Setup PRDT
-    cmdtbl->prdt_entry[0].dba = (uint32_t)(uintptr_t)buffer;
-    cmdtbl->prdt_entry[0].dbau = (uint32_t)((uintptr_t)buffer >> 32);
+    uint64_t buffer_phys = virt_to_phys((void*)buffer);
+    if ((buffer_phys >> 32) && !(g_abar->cap & AHCI_CAP_S64A)) {
+        kprintf("AHCI: Buffer above 4 GiB but HBA lacks 64-bit DMA\n", 0xFFFF0000);
+        return -1;
+    }
+    cmdtbl->prdt_entry[0].dba = (uint32_t)buffer_phys;
+    cmdtbl->prdt_entry[0].dbau = (uint32_t)(buffer_phys >> 32);
     cmdtbl->prdt_entry[0].dbc = (count * 512) - 1; // 512 bytes per sector, 0-based
     cmdtbl->prdt_entry[0].i = 0;
     
@@ -246,11 +280,8 @@ static int port_read(ahci_hba_port_t *port, uint64_t lba, uint32_t count, uint8_
     cmdfis->device = 1 << 6; // LBA mode
     cmdfis->count = (uint16_t)count;
     
-    // Wait for port to be ready
-    int timeout = 100000;
-    while ((port->tfd & (0x80 | 0x08)) && timeout-- > 0);
-    
-    if (timeout == 0) {
+    // Wait for port to be ready (BSY and DRQ clear)
+    if (!timer_poll_until(!(port->tfd & (0x80 | 0x08)), AHCI_CMD_TIMEOUT_US, AHCI_POLL_US)) {
         kprintf("AHCI: Port hung\n", 0xFFFF0000);
         return -1;
     }
@@ -258,20 +289,7 @@ static int port_read(ahci_hba_port_t *port, uint64_t lba, uint32_t count, uint8_
     // Issue command
     port->ci = 1 << slot;
     
-    // Wait for completion
-    timeout = 1000000;
-    while (timeout-- > 0) {
-        if ((port->ci & (1 << slot)) == 0) break;
-        if (port->is & (1 << 30)) { // Task file error
-            kprintf("AHCI: Task file error\n", 0xFFFF0000);
-            return -1;
-        }
-    }
-    
-    if (timeout == 0) {
-        kprintf("AHCI: Read timeout\n", 0xFFFF0000);
-        return -1;
-    }
+    if (port_wait_complete(port, slot, "Read") < 0) return -1;
     
     if (port->is & (1 << 30)) {
         kprintf("AHCI: Task file error after completion\n", 0xFFFF0000);
@@ -292,19 +310,24 @@ static int port_write(ahci_hba_port_t *port, uint64_t lba, uint32_t count, const
     }
     
     // Get command list
-    ahci_cmd_header_t *cmdheader = (ahci_cmd_header_t*)(uintptr_t)(uint64_t)port->clb;
+    ahci_cmd_header_t *cmdheader = (ahci_cmd_header_t*)phys_to_virt(((uint64_t)port->clbu << 32) | port->clb);
     cmdheader += slot;
     cmdheader->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
     cmdheader->w = 1; // Write
     cmdheader->prdtl = 1;
     
     // Command table
-    ahci_cmd_table_t *cmdtbl = (ahci_cmd_table_t*)(uintptr_t)(uint64_t)cmdheader->ctba;
+    ahci_cmd_table_t *cmdtbl = (ahci_cmd_table_t*)phys_to_virt(((uint64_t)cmdheader->ctbau << 32) | cmdheader->ctba);
     custom_memset(cmdtbl, 0, sizeof(ahci_cmd_table_t));
     
     // Setup PRDT
-    cmdtbl->prdt_entry[0].dba = (uint32_t)(uintptr_t)buffer;
-    cmdtbl->prdt_entry[0].dbau = (uint32_t)((uintptr_t)buffer >> 32);
+    uint64_t buffer_phys = virt_to_phys((void*)buffer);
+    if ((buffer_phys >> 32) && !(g_abar->cap & AHCI_CAP_S64A)) {
+        kprintf("AHCI: Buffer above 4 GiB but HBA lacks 64-bit DMA\n", 0xFFFF0000);
+        return -1;
+    }
+    cmdtbl->prdt_entry[0].dba = (uint32_t)buffer_phys;
+    cmdtbl->prdt_entry[0].dbau = (uint32_t)(buffer_phys >> 32);
     cmdtbl->prdt_entry[0].dbc = (count * 512) - 1;
     cmdtbl->prdt_entry[0].i = 0;
     
@@ -324,11 +347,8 @@ static int port_write(ahci_hba_port_t *port, uint64_t lba, uint32_t count, const
     cmdfis->device = 1 << 6; // LBA mode
     cmdfis->count = (uint16_t)count;
     
-    // Wait for port to be ready
-    int timeout = 100000;
-    while ((port->tfd & (0x80 | 0x08)) && timeout-- > 0);
-    
-    if (timeout == 0) {
+    // Wait for port to be ready (BSY and DRQ clear)
+    if (!timer_poll_until(!(port->tfd & (0x80 | 0x08)), AHCI_CMD_TIMEOUT_US, AHCI_POLL_US)) {
         kprintf("AHCI: Port hung\n", 0xFFFF0000);
         return -1;
     }
@@ -336,20 +356,7 @@ static int port_write(ahci_hba_port_t *port, uint64_t lba, uint32_t count, const
     // Issue command
     port->ci = 1 << slot;
     
-    // Wait for completion
-    timeout = 1000000;
-    while (timeout-- > 0) {
-        if ((port->ci & (1 << slot)) == 0) break;
-        if (port->is & (1 << 30)) {
-            kprintf("AHCI: Task file error\n", 0xFFFF0000);
-            return -1;
-        }
-    }
-    
-    if (timeout == 0) {
-        kprintf("AHCI: Write timeout\n", 0xFFFF0000);
-        return -1;
-    }
+    if (port_wait_complete(port, slot, "Write") < 0) return -1;
     
     if (port->is & (1 << 30)) {
         kprintf("AHCI: Task file error after completion\n", 0xFFFF0000);
@@ -407,38 +414,36 @@ int ahci_init(void) {
                     port_stop_cmd(port);
                     
                     // Allocate command list (1KB, 32 entries * 32 bytes)
-                    uint8_t *cmd_list = (uint8_t*)pfa_alloc();
-                    if (!cmd_list) {
+                    uint64_t cmd_list_phys = pfa_alloc_low_zeroed();
+                    if (!cmd_list_phys) {
                         kprintf("AHCI: Failed to allocate command list\n", 0xFFFF0000);
                         return -1;
                     }
-                    custom_memset(cmd_list, 0, 4096);
+                    uint8_t *cmd_list = (uint8_t*)phys_to_virt(cmd_list_phys);
                     
                     // Allocate FIS area (256 bytes)
-                    uint8_t *fis = (uint8_t*)pfa_alloc();
-                    if (!fis) {
+                    uint64_t fis_phys = pfa_alloc_low_zeroed();
+                    if (!fis_phys) {
                         kprintf("AHCI: Failed to allocate FIS\n", 0xFFFF0000);
                         return -1;
                     }
-                    custom_memset(fis, 0, 4096);
                     
                     // Allocate command tables (need at least 256 bytes per entry, let's use 1 page for 1 entry)
-                    uint8_t *cmd_table = (uint8_t*)pfa_alloc();
-                    if (!cmd_table) {
+                    uint64_t cmd_table_phys = pfa_alloc_low_zeroed();
+                    if (!cmd_table_phys) {
                         kprintf("AHCI: Failed to allocate command table\n", 0xFFFF0000);
                         return -1;
                     }
-                    custom_memset(cmd_table, 0, 4096);
                     
-                    port->clb = (uint32_t)(uintptr_t)cmd_list;
-                    port->clbu = (uint32_t)((uintptr_t)cmd_list >> 32);
-                    port->fb = (uint32_t)(uintptr_t)fis;
-                    port->fbu = (uint32_t)((uintptr_t)fis >> 32);
+                    port->clb = (uint32_t)cmd_list_phys;
+                    port->clbu = (uint32_t)(cmd_list_phys >> 32);
+                    port->fb = (uint32_t)fis_phys;
+                    port->fbu = (uint32_t)(fis_phys >> 32);
                     
                     // Set command table address in command header
                     ahci_cmd_header_t *cmdheader = (ahci_cmd_header_t*)cmd_list;
-                    cmdheader->ctba = (uint32_t)(uintptr_t)cmd_table;
-                    cmdheader->ctbau = (uint32_t)((uintptr_t)cmd_table >> 32);
+                    cmdheader->ctba = (uint32_t)cmd_table_phys;
+                    cmdheader->ctbau = (uint32_t)(cmd_table_phys >> 32);
                     
                     // Start command engine
                     port_start_cmd(port);
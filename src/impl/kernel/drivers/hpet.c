@@ -0,0 +1,178 @@
+#include "include/hpet.h"
+#include "include/acpi.h"
+#include "include/mm.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Forward declaration for kprintf
+extern void kprintf(const char *format, uint32_t color, ...);
+
+// Register offsets
+#define HPET_GCAP_ID     0x000
+#define HPET_GEN_CONF    0x010
+#define HPET_GINTR_STA   0x020
+#define HPET_MAIN_CNT    0x0F0
+#define HPET_TIMER_CONF(n) (0x100 + 0x20 * (n))
+#define HPET_TIMER_CMP(n)  (0x108 + 0x20 * (n))
+
+// General capabilities
+#define HPET_CAP_COUNT_64   (1ULL << 13)
+#define HPET_CAP_NUM_TIM(c) ((((c) >> 8) & 0x1F) + 1)
+#define HPET_CAP_PERIOD(c)  ((c) >> 32)     // Femtoseconds per tick
+
+// General configuration
+#define HPET_CONF_ENABLE    (1ULL << 0)
+#define HPET_CONF_LEGACY    (1ULL << 1)
+
+// Timer configuration
+#define HPET_TN_LEVEL       (1ULL << 1)
+#define HPET_TN_INT_ENB     (1ULL << 2)
+#define HPET_TN_PERIODIC    (1ULL << 3)
+#define HPET_TN_PER_CAP     (1ULL << 4)
+#define HPET_TN_VAL_SET     (1ULL << 6)
+#define HPET_TN_32BIT       (1ULL << 8)
+#define HPET_TN_ROUTE_SHIFT 9
+#define HPET_TN_ROUTE_MASK  (0x1FULL << 9)
+#define HPET_TN_ROUTE_CAP(c) ((uint32_t)((c) >> 32))
+
+#define FS_PER_NS 1000000ULL
+#define FS_PER_S  1000000000000000ULL
+
+// Tick <-> nanosecond conversions are multiply-and-shift, like the TSC's
+#define HPET_SHIFT 32
+
+static volatile uint64_t *hpet_regs = NULL;
+static uint64_t hpet_period_fs;
+static uint64_t hpet_hz;
+static uint64_t hpet_mask;
+static uint64_t ns_per_tick;    // Nanoseconds per tick << HPET_SHIFT
+static uint64_t ticks_per_ns;   // Ticks per nanosecond << HPET_SHIFT
+static int hpet_timers;
+
+static inline uint64_t hpet_read(uint32_t reg) {
+    return hpet_regs[reg / 8];
+}
+
+static inline void hpet_write(uint32_t reg, uint64_t value) {
+    hpet_regs[reg / 8] = value;
+}
+
+int hpet_init(void) {
+    struct acpi_hpet *table = (struct acpi_hpet *)acpi_find_table("HPET");
+    if (!table) {
+        kprintf("HPET: No HPET table\n", 0xFFFF0000);
+        return -1;
+    }
+    if (table->base_address.address_space_id != 0) {
+        kprintf("HPET: Registers not in memory space\n", 0xFFFF0000);
+        return -1;
+    }
+
+    uint64_t phys = table->base_address.address;
+    volatile uint64_t *regs = mmio_remap(phys, 1024);
+    if (!regs) return -1;
+    hpet_regs = regs;
+
+    uint64_t cap = hpet_read(HPET_GCAP_ID);
+    hpet_period_fs = HPET_CAP_PERIOD(cap);
+    // The spec caps the period at 100 ns; zero or more means no usable HPET
+    if (hpet_period_fs == 0 || hpet_period_fs > 100 * FS_PER_NS) {
+        kprintf("HPET: Invalid counter period %lu fs\n", 0xFFFF0000, hpet_period_fs);
+        hpet_regs = NULL;
+        return -1;
+    }
+    hpet_hz = FS_PER_S / hpet_period_fs;
+    ns_per_tick = (hpet_period_fs << HPET_SHIFT) / FS_PER_NS;
+    ticks_per_ns = (FS_PER_NS << HPET_SHIFT) / hpet_period_fs;
+    hpet_mask = (cap & HPET_CAP_COUNT_64) ? ~0ULL : 0xFFFFFFFFULL;
+    hpet_timers = HPET_CAP_NUM_TIM(cap);
+
+    // Comparators off until someone asks for one, legacy replacement
+    // routing off (the PIT and RTC keep their IRQs), then start counting
+    uint64_t conf = hpet_read(HPET_GEN_CONF) & ~(HPET_CONF_ENABLE | HPET_CONF_LEGACY);
+    hpet_write(HPET_GEN_CONF, conf);
+    for (int i = 0; i < hpet_timers; i++) {
+        hpet_write(HPET_TIMER_CONF(i), hpet_read(HPET_TIMER_CONF(i)) & ~(HPET_TN_INT_ENB | HPET_TN_PERIODIC));
+    }
+    hpet_write(HPET_MAIN_CNT, 0);
+    hpet_write(HPET_GEN_CONF, conf | HPET_CONF_ENABLE);
+
+    kprintf("HPET: Base 0x%lx, %lu kHz, %d-bit counter, %d comparators\n", 0x00FF0000,
+            phys, hpet_hz / 1000, hpet_mask == ~0ULL ? 64 : 32, hpet_timers);
+    return 0;
+}
+
+int hpet_available(void) {
+    return hpet_regs != NULL;
+}
+
+uint64_t hpet_read_counter(void) {
+    return hpet_regs ? hpet_read(HPET_MAIN_CNT) & hpet_mask : 0;
+}
+
+uint64_t hpet_frequency(void) {
+    return hpet_hz;
+}
+
+uint64_t hpet_counter_mask(void) {
+    return hpet_mask;
+}
+
+uint64_t hpet_ticks_to_ns(uint64_t ticks) {
+    return (uint64_t)(((unsigned __int128)ticks * ns_per_tick) >> HPET_SHIFT);
+}
+
+static uint64_t ns_to_ticks(uint64_t ns) {
+    uint64_t ticks = (uint64_t)(((unsigned __int128)ns * ticks_per_ns) >> HPET_SHIFT);
+    return ticks ? ticks : 1;
+}
+
+void hpet_ndelay(uint64_t ns) {
+    if (!hpet_regs) return;
+    uint64_t start = hpet_read_counter();
+    uint64_t ticks = ns_to_ticks(ns);
+    while (((hpet_read_counter() - start) & hpet_mask) < ticks) __asm__ volatile("pause");
+}
+
+int hpet_timer_count(void) {
+    return hpet_regs ? hpet_timers : 0;
+}
+
+// Route timer n to gsi as an edge-triggered interrupt and return its
+// configuration with the interrupt still disabled, or 0 if not possible
+static uint64_t timer_prepare(int n, uint32_t gsi) {
+    if (!hpet_regs || n < 0 || n >= hpet_timers || gsi > 31) return 0;
+    uint64_t conf = hpet_read(HPET_TIMER_CONF(n));
+    if (!(HPET_TN_ROUTE_CAP(conf) & (1u << gsi))) return 0;
+    conf &= ~(HPET_TN_INT_ENB | HPET_TN_PERIODIC | HPET_TN_LEVEL | HPET_TN_ROUTE_MASK | HPET_TN_32BIT);
+    conf |= (uint64_t)gsi << HPET_TN_ROUTE_SHIFT;
+    hpet_write(HPET_TIMER_CONF(n), conf);
+    return conf;
+}
+
+int hpet_timer_oneshot(int timer, uint64_t delta_ns, uint32_t gsi) {
+    uint64_t conf = timer_prepare(timer, gsi);
+    if (!conf) return -1;
+    uint64_t target = (hpet_read_counter() + ns_to_ticks(delta_ns)) & hpet_mask;
+    hpet_write(HPET_TIMER_CMP(timer), target);
+    hpet_write(HPET_TIMER_CONF(timer), conf | HPET_TN_INT_ENB);
+    return 0;
+}
+
+int hpet_timer_periodic(int timer, uint64_t period_ns, uint32_t gsi) {
+    uint64_t conf = timer_prepare(timer, gsi);
+    if (!conf || !(conf & HPET_TN_PER_CAP)) return -1;
+    uint64_t period = ns_to_ticks(period_ns);
+    // With VAL_SET the first write sets the comparator and the second the
+    // period it is advanced by on every match
+    hpet_write(HPET_TIMER_CONF(timer), conf | HPET_TN_PERIODIC | HPET_TN_VAL_SET);
+    hpet_write(HPET_TIMER_CMP(timer), (hpet_read_counter() + period) & hpet_mask);
+    hpet_write(HPET_TIMER_CMP(timer), period);
+    hpet_write(HPET_TIMER_CONF(timer), conf | HPET_TN_PERIODIC | HPET_TN_INT_ENB);
+    return 0;
+}
+
+void hpet_timer_stop(int timer) {
+    if (!hpet_regs || timer < 0 || timer >= hpet_timers) return;
+    hpet_write(HPET_TIMER_CONF(timer), hpet_read(HPET_TIMER_CONF(timer)) & ~(HPET_TN_INT_ENB | HPET_TN_PERIODIC));
+}
@@ -0,0 +1,141 @@
+#include "include/ioapic.h"
+#include "include/acpi.h"
+#include "include/mm.h"
+#include "include/spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Forward declaration for kprintf
+extern void kprintf(const char *format, uint32_t color, ...);
+
+// Recorded by acpi_parse_madt
+extern int acpi_ioapic_count;
+extern struct acpi_ioapic_info acpi_ioapics[];
+extern struct acpi_irq_override acpi_irq_overrides[];
+
+// Registers are reached indirectly: select with IOREGSEL, access via IOWIN
+#define IOAPIC_IOREGSEL 0x00
+#define IOAPIC_IOWIN    0x10
+
+#define IOAPIC_REG_ID    0x00
+#define IOAPIC_REG_VER   0x01
+#define IOAPIC_REG_REDTBL(n) (0x10 + 2 * (n))
+
+// Redirection entry, low dword
+#define IOAPIC_ACTIVE_LOW (1 << 13)
+#define IOAPIC_LEVEL      (1 << 15)
+#define IOAPIC_MASKED     (1 << 16)
+
+struct ioapic {
+    volatile uint32_t *regs;
+    uint32_t gsi_base;
+    uint32_t inputs;
+    spinlock_t lock;    // Guards the IOREGSEL/IOWIN pair
+};
+
+static struct ioapic ioapics[ACPI_MAX_IOAPICS];
+static int ioapic_count = 0;
+
+static uint32_t ioapic_read(struct ioapic *io, uint32_t reg) {
+    io->regs[IOAPIC_IOREGSEL / 4] = reg;
+    return io->regs[IOAPIC_IOWIN / 4];
+}
+
+static void ioapic_write(struct ioapic *io, uint32_t reg, uint32_t value) {
+    io->regs[IOAPIC_IOREGSEL / 4] = reg;
+    io->regs[IOAPIC_IOWIN / 4] = value;
+}
+
+// I/O APIC serving `gsi`, with *pin set to its input number there
+static struct ioapic *ioapic_for_gsi(uint32_t gsi, uint32_t *pin) {
+    for (int i = 0; i < ioapic_count; i++) {
+        struct ioapic *io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->inputs) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return NULL;
+}
+
+int ioapic_init(void) {
+    for (int i = 0; i < acpi_ioapic_count; i++) {
+        struct acpi_ioapic_info *info = &acpi_ioapics[i];
+        volatile uint32_t *regs = mmio_remap(info->address, 4096);
+        if (!regs) continue;
+
+        struct ioapic *io = &ioapics[ioapic_count++];
+        io->regs = regs;
+        io->gsi_base = info->gsi_base;
+        io->inputs = ((ioapic_read(io, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+
+        // Whatever the firmware left programmed stays off until routed
+        for (uint32_t pin = 0; pin < io->inputs; pin++) {
+            ioapic_write(io, IOAPIC_REG_REDTBL(pin), IOAPIC_MASKED);
+            ioapic_write(io, IOAPIC_REG_REDTBL(pin) + 1, 0);
+        }
+
+        kprintf("IOAPIC: ID %d at 0x%lx, GSI %u-%u\n", 0x00FF0000, info->id,
+                (uint64_t)info->address, io->gsi_base, io->gsi_base + io->inputs - 1);
+    }
+
+    if (ioapic_count == 0) {
+        kprintf("IOAPIC: None found\n", 0xFFFF0000);
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t ioapic_isa_to_gsi(uint8_t irq, int *level, int *active_low) {
+    // ISA interrupts are edge-triggered and active-high unless overridden
+    *level = 0;
+    *active_low = 0;
+    if (irq >= 16 || !acpi_irq_overrides[irq].present) return irq;
+
+    struct acpi_irq_override *o = &acpi_irq_overrides[irq];
+    *level = (o->flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL;
+    *active_low = (o->flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW;
+    return o->gsi;
+}
+
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t dest, int level, int active_low, int masked) {
+    uint32_t pin;
+    struct ioapic *io = ioapic_for_gsi(gsi, &pin);
+    if (!io) return -1;
+
+    uint32_t low = vector;
+    if (level) low |= IOAPIC_LEVEL;
+    if (active_low) low |= IOAPIC_ACTIVE_LOW;
+    if (masked) low |= IOAPIC_MASKED;
+
+    // Destination first, so the entry never fires at a stale CPU
+    uint64_t flags = spin_lock_irqsave(&io->lock);
+    ioapic_write(io, IOAPIC_REG_REDTBL(pin), IOAPIC_MASKED);
+    ioapic_write(io, IOAPIC_REG_REDTBL(pin) + 1, dest << 24);
+    ioapic_write(io, IOAPIC_REG_REDTBL(pin), low);
+    spin_unlock_irqrestore(&io->lock, flags);
+    return 0;
+}
+
+void ioapic_set_masked(uint32_t gsi, int masked) {
+    uint32_t pin;
+    struct ioapic *io = ioapic_for_gsi(gsi, &pin);
+    if (!io) return;
+
+    uint64_t flags = spin_lock_irqsave(&io->lock);
+    uint32_t low = ioapic_read(io, IOAPIC_REG_REDTBL(pin));
+    low = masked ? (low | IOAPIC_MASKED) : (low & ~IOAPIC_MASKED);
+    ioapic_write(io, IOAPIC_REG_REDTBL(pin), low);
+    spin_unlock_irqrestore(&io->lock, flags);
+}
+
+int ioapic_set_dest(uint32_t gsi, uint32_t dest) {
+    uint32_t pin;
+    struct ioapic *io = ioapic_for_gsi(gsi, &pin);
+    if (!io) return -1;
+
+    uint64_t flags = spin_lock_irqsave(&io->lock);
+    ioapic_write(io, IOAPIC_REG_REDTBL(pin) + 1, dest << 24);
+    spin_unlock_irqrestore(&io->lock, flags);
+    return 0;
+}
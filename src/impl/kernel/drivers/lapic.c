@@ -0,0 +1,159 @@
+#include "include/lapic.h"
+#include "include/acpi.h"
+#include "include/mm.h"
+#include "include/spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Forward declaration for kprintf
+extern void kprintf(const char *format, uint32_t color, ...);
+
+// Register offsets
+#define LAPIC_ID        0x020
+#define LAPIC_VERSION   0x030
+#define LAPIC_TPR       0x080
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0
+#define LAPIC_ESR       0x280
+#define LAPIC_ICR_LO    0x300
+#define LAPIC_ICR_HI    0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define LAPIC_SVR_ENABLE      (1 << 8)
+#define LAPIC_ICR_PENDING     (1 << 12)
+#define LAPIC_ICR_ASSERT      (1 << 14)
+#define LAPIC_ICR_INIT        (5 << 8)
+#define LAPIC_ICR_STARTUP     (6 << 8)
+#define LAPIC_ICR_ALL_BUT_SELF (3 << 18)
+
+#define LAPIC_LVT_MASKED       (1 << 16)
+#define LAPIC_TIMER_MODE_SHIFT 17
+#define LAPIC_TIMER_MODE_MASK  (3 << 17)
+#define LAPIC_TIMER_DIV_16     0x3
+
+#define MSR_APIC_BASE 0x1B
+#define MSR_TSC_DEADLINE 0x6E0
+
+// Shared by every CPU; each one sees its own APIC at this address
+static volatile uint32_t *lapic_regs = NULL;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic_regs[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_regs[reg / 4] = value;
+}
+
+static void lapic_wait_icr(void) {
+    while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING) __asm__ volatile("pause");
+}
+
+// The ICR is written as two halves; keep an interrupt from sending its own
+// IPI in between.
+static void lapic_send(uint32_t apic_id, uint32_t icr_lo) {
+    uint64_t flags = local_irq_save();
+    lapic_wait_icr();
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, icr_lo);
+    lapic_wait_icr();
+    local_irq_restore(flags);
+}
+
+void lapic_cpu_init(void) {
+    // Accept all interrupt priorities and software-enable the APIC
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    // ESR must be written before it is read
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+}
+
+int lapic_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & (1 << 9))) {
+        kprintf("LAPIC: CPU has no local APIC\n", 0xFFFF0000);
+        return -1;
+    }
+
+    uint64_t phys = acpi_get_local_apic_address();
+    if (!phys) {
+        uint32_t lo, hi;
+        __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_APIC_BASE));
+        phys = (((uint64_t)hi << 32) | lo) & ~0xFFFULL;
+    }
+
+    volatile uint32_t *regs = mmio_remap(phys, 4096);
+    if (!regs) return -1;
+    lapic_regs = regs;
+    lapic_cpu_init();
+
+    kprintf("LAPIC: Base 0x%lx, version 0x%x, BSP APIC ID %d\n", 0x00FF0000,
+            phys, lapic_read(LAPIC_VERSION) & 0xFF, lapic_id());
+    return 0;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    lapic_send(apic_id, LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_send_ipi_others(uint8_t vector) {
+    lapic_send(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    lapic_send(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+}
+
+void lapic_send_startup(uint32_t apic_id, uint8_t page) {
+    lapic_send(apic_id, LAPIC_ICR_STARTUP | page);
+}
+
+int lapic_has_tsc_deadline(void) {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return (ecx >> 24) & 1;
+}
+
+void lapic_timer_setup(int mode) {
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | ((uint32_t)mode << LAPIC_TIMER_MODE_SHIFT));
+    // Order the LVT write before any later deadline MSR write
+    if (mode == LAPIC_TIMER_TSC_DEADLINE) __asm__ volatile("mfence" ::: "memory");
+}
+
+void lapic_timer_oneshot(uint32_t count) {
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+void lapic_timer_periodic(uint32_t count) {
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+void lapic_timer_deadline(uint64_t tsc) {
+    __asm__ volatile("wrmsr" : : "c"(MSR_TSC_DEADLINE), "a"((uint32_t)tsc), "d"((uint32_t)(tsc >> 32)));
+}
+
+void lapic_timer_stop(void) {
+    // Each CPU's mode is in its own LVT, so this is right wherever it runs
+    uint32_t mode = (lapic_read(LAPIC_LVT_TIMER) & LAPIC_TIMER_MODE_MASK) >> LAPIC_TIMER_MODE_SHIFT;
+    if (mode == LAPIC_TIMER_TSC_DEADLINE) lapic_timer_deadline(0);
+    else lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+uint32_t lapic_timer_current(void) {
+    return lapic_read(LAPIC_TIMER_CUR);
+}
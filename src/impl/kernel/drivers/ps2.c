@@ -1,20 +1,49 @@
 #include <stdint.h>
 #include "include/ps2.h"
 #include "include/console.h"
+#include "include/sched.h"
+#include "include/wait.h"
+#include "include/workqueue.h"
+#include "include/spinlock.h"
 #include <stdint.h>
 
-// Simple ring buffer for keyboard input (shared between PS/2 and USB)
+// The USB keyboard has no interrupt wired up, so a blocked reader still
+// wakes this often to poll it
+#define INPUT_POLL_US 10000
+
+// Simple ring buffer for keyboard input (shared between PS/2 and USB).
+// The PS/2 worker and USB polling from any CPU both produce, and readers
+// on any CPU consume, so head and tail only move under input_lock.
 static volatile unsigned int in_head = 0;
 static volatile unsigned int in_tail = 0;
 static volatile char in_buf[256];
+static spinlock_t input_lock = SPINLOCK_INIT;
+
+// Readers blocked in ps2_getchar
+static wait_queue_t input_wait = WAIT_QUEUE_INIT;
 
 // Add a character to the input buffer (callable from USB HID driver)
 void input_add_char(char c) {
+    uint64_t flags = spin_lock_irqsave(&input_lock);
     unsigned int next = (in_head + 1) & 255;
     if (next != in_tail) {
         in_buf[in_head] = c;
         in_head = next;
     }
+    spin_unlock_irqrestore(&input_lock, flags);
+    wake_up(&input_wait);
+}
+
+// Take the oldest character, or -1 if the buffer is empty
+static int input_take_char(void) {
+    uint64_t flags = spin_lock_irqsave(&input_lock);
+    int c = -1;
+    if (in_head != in_tail) {
+        c = (unsigned char)in_buf[in_tail];
+        in_tail = (in_tail + 1) & 255;
+    }
+    spin_unlock_irqrestore(&input_lock, flags);
+    return c;
 }
 
 // Port addresses
@@ -47,11 +76,9 @@ static const char scancode_shift_map[128] = {
     '|','Z','X','C','V','B','N','M','<','>','?', 0, '*', 0, ' ',
 };
 
-void ps2_handle_interrupt(void) {
-    uint8_t status = inb(KBD_STATUS_PORT);
-    if (!(status & 1)) return; // no data
-    uint8_t sc = inb(KBD_DATA_PORT);
-
+// Translate one scancode. May talk to the controller (LED updates) and
+// print, so this runs from the workqueue rather than the interrupt.
+static void ps2_process_scancode(uint8_t sc) {
     // Track modifier and lock key state
     static volatile int shift = 0;
     static volatile int caps = 0;
@@ -114,13 +141,7 @@ void ps2_handle_interrupt(void) {
             if (numlock) out = keypad_num_map[sc - 0x47];
             // if numlock is off, we currently don't translate keypad to navigation
             // sequences (could be added later). If out is zero, treat as no character.
-            if (out) {
-                unsigned int next = (in_head + 1) & 255;
-                if (next != in_tail) {
-                    in_buf[in_head] = out;
-                    in_head = next;
-                }
-            }
+            if (out) input_add_char(out);
             return;
         }
 
@@ -141,39 +162,84 @@ void ps2_handle_interrupt(void) {
                 // we leave the base char; shift map above covers standard cases.
             }
 
-            // Enqueue
-            unsigned int next = (in_head + 1) & 255;
-            if (next != in_tail) {
-                in_buf[in_head] = out;
-                in_head = next;
-            }
+            input_add_char(out);
+        }
+    }
+}
+
+// Raw scancodes read by the interrupt handler, waiting to be decoded.
+// IRQ1 on the BSP and the polling fallback on any CPU both fill the
+// buffer, so it is only touched under ps2_lock. The decoder itself (and
+// its shift/lock state) is serialized by always running on CPU 0's
+// worker, and runs with interrupts on.
+static volatile uint8_t sc_buf[64];
+static volatile unsigned int sc_head = 0;
+static volatile unsigned int sc_tail = 0;
+static spinlock_t ps2_lock = SPINLOCK_INIT;
+
+static void ps2_drain(void) {
+    for (;;) {
+        uint64_t flags = spin_lock_irqsave(&ps2_lock);
+        if (sc_tail == sc_head) {
+            spin_unlock_irqrestore(&ps2_lock, flags);
+            return;
         }
+        uint8_t sc = sc_buf[sc_tail];
+        sc_tail = (sc_tail + 1) & 63;
+        spin_unlock_irqrestore(&ps2_lock, flags);
+        ps2_process_scancode(sc);
     }
 }
 
+static void ps2_work_fn(work_t *work) {
+    (void)work;
+    ps2_drain();
+}
+
+static work_t ps2_work = WORK_INIT(ps2_work_fn);
+
+// IRQ1 (and the polling fallback in ps2_getchar): read the byte and leave
+// the decoding to the workqueue
+void ps2_handle_interrupt(void) {
+    uint64_t flags = spin_lock_irqsave(&ps2_lock);
+    uint8_t status = inb(KBD_STATUS_PORT);
+    if (!(status & 1)) { // no data
+        spin_unlock_irqrestore(&ps2_lock, flags);
+        return;
+    }
+    uint8_t sc = inb(KBD_DATA_PORT);
+    unsigned int next = (sc_head + 1) & 63;
+    if (next != sc_tail) {
+        sc_buf[sc_head] = sc;
+        sc_head = next;
+    }
+    spin_unlock_irqrestore(&ps2_lock, flags);
+
+    // No worker yet (early boot): decode right here as before
+    if (schedule_work_on(0, &ps2_work) < 0) ps2_drain();
+}
+
 // USB keyboard polling function (from xhci.c)
 extern void usb_kbd_poll(void);
 
 int ps2_getchar(void) {
-    // Active polling loop for both PS/2 and USB keyboard
-    // We poll USB then briefly enable interrupts for PS/2
-    while (in_head == in_tail) {
+    // PS/2 input arrives through IRQ1 and wakes us; USB input is polled
+    // each time round, so sleep for at most INPUT_POLL_US
+    int c;
+    while ((c = input_take_char()) < 0) {
         // Poll USB keyboard (non-blocking)
         usb_kbd_poll();
         
-        // Check PS/2 keyboard (non-blocking) 
+        // Check PS/2 keyboard (non-blocking) in case IRQ1 is masked
         uint8_t status = inb(KBD_STATUS_PORT);
         if (status & 1) {
             // Data available, handle it
             ps2_handle_interrupt();
         }
         
-        // Small delay to avoid burning CPU 100%
-        for (volatile int i = 0; i < 1000; i++);
+        wait_event_timeout(&input_wait, in_head != in_tail, INPUT_POLL_US);
     }
-    char c = in_buf[in_tail];
-    in_tail = (in_tail + 1) & 255;
-    return (int)c;
+    return c;
 }
 
 // Non-blocking try_getchar: return -1 when no character is available
@@ -188,10 +254,7 @@ int try_getchar(void) {
     }
     
     // Check if any character is now available
-    if (in_head == in_tail) return -1;
-    char c = in_buf[in_tail];
-    in_tail = (in_tail + 1) & 255;
-    return (int)c;
+    return input_take_char();
 }
 
 void ps2_init(void) {
@@ -6,6 +6,7 @@
 #include "include/stdio.h"
 #include <stddef.h>
 #include "include/mm.h"
+#include "include/timer.h"
 #include <stdint.h> // Include for standard integer types
 
 // Forward declaration for kprintf from main.c
@@ -130,6 +131,16 @@ typedef struct __attribute__((packed, aligned(64))) {
 #define XHCI_DCBAA_SIZE (XHCI_MAX_SLOTS + 1) // Max 256 device slots + 1 (index 0 is reserved)
 #define XHCI_EP_RING_SIZE 32
 
+// Command completion: give up after a second, poll every 100 us
+#define XHCI_CMD_TIMEOUT_US 1000000
+#define XHCI_POLL_US        100
+
+// Controller handoff, reset, start and port reset limits
+#define XHCI_HANDOFF_TIMEOUT_US 1000000
+#define XHCI_RESET_TIMEOUT_US   1000000
+#define XHCI_START_TIMEOUT_US   1000000
+#define XHCI_PORT_RESET_TIMEOUT_US 1000000
+
 // Statically allocated memory for xHCI structures (must be 64-byte aligned)
 // __attribute__((aligned(64))) ensures 64-byte alignment
 static __attribute__((aligned(64))) xhci_trb_t xhci_cmd_ring[XHCI_CMD_RING_SIZE];
@@ -223,9 +234,10 @@ static int xhci_send_command(xhci_trb_t *command_trb, uint32_t *completion_code_
     xhci_doorbell_regs[0] = 0; // Target Doorbell 0 (Host Controller), value 0 (no slot ID)
     kprintf("xHCI: Command sent. Waiting for completion...\n", 0x00FF0000);
 
-    // Wait for Command Completion Event on the Event Ring
-    int timeout = 1000000; // ~1 second timeout
-    while (timeout > 0) {
+    // Wait for Command Completion Event on the Event Ring. The event ring
+    // interrupt is not routed, so sleep between polls rather than spin.
+    uint64_t deadline = timer_get_uptime_us() + XHCI_CMD_TIMEOUT_US;
+    for (;;) {
         xhci_trb_t *event_trb = &xhci_event_ring[event_ring_dequeue_ptr];
 
         // Check Cycle Bit
@@ -263,8 +275,8 @@ static int xhci_send_command(xhci_trb_t *command_trb, uint32_t *completion_code_
             }
         }
 
-        for (volatile int i = 0; i < 100; i++); // Simple busy-wait
-        timeout--;
+        if (timer_get_uptime_us() >= deadline) break;
+        timer_sleep_us(XHCI_POLL_US);
     }
 
     kprintf("xHCI: Command Completion Event timeout!\n", 0xFF0000);
@@ -305,14 +317,7 @@ static void xhci_perform_bios_handoff(volatile xhci_cap_regs_t *cap_regs, uintpt
                 *usblegsup |= (1 << 24);
                 
                 // Wait for BIOS Owned Semaphore (bit 16) to clear
-                // Timeout logic needed (usually fairly quick)
-                int timeout = 100000; // Arbitrary loop count
-                while ((*usblegsup & (1 << 16)) && timeout > 0) {
-                    timeout--;
-                    for (volatile int i = 0; i < 100; i++);
-                }
-                
-                if (timeout > 0) {
+                if (timer_poll_until(!(*usblegsup & (1 << 16)), XHCI_HANDOFF_TIMEOUT_US, XHCI_POLL_US)) {
                     kprintf("xHCI: BIOS Handoff successful.\n", 0x00FF0000);
                 } else {
                     kprintf("xHCI: BIOS Handoff timed out! Forcing takeover.\n", 0xFF0000);
@@ -414,15 +419,10 @@ void xhci_init() {
 
         // Wait for HCRST bit to clear
         // And wait for CNR (Controller Not Ready) bit (bit 11) in USBSTS to clear
-        int hcrst_timeout = 1000000; // ~1 second timeout
-        while ((xhci_op_regs->usbcmd & (1 << 1)) || (xhci_op_regs->usbsts & (1 << 11))) {
-            // Simple busy-wait loop for now. In a real OS, this would be a proper delay.
-            for (volatile int i = 0; i < 100; i++); 
-            hcrst_timeout--;
-            if (hcrst_timeout <= 0) {
-                kprintf("xHCI: HCRST timeout! USBCMD=0x%x, USBSTS=0x%x\n", 0xFF0000, xhci_op_regs->usbcmd, xhci_op_regs->usbsts);
-                return;
-            }
+        if (!timer_poll_until(!(xhci_op_regs->usbcmd & (1 << 1)) && !(xhci_op_regs->usbsts & (1 << 11)),
+                              XHCI_RESET_TIMEOUT_US, XHCI_POLL_US)) {
+            kprintf("xHCI: HCRST timeout! USBCMD=0x%x, USBSTS=0x%x\n", 0xFF0000, xhci_op_regs->usbcmd, xhci_op_regs->usbsts);
+            return;
         }
         kprintf("xHCI: HCRST complete.\n", 0x00FF0000);
 
@@ -468,7 +468,7 @@ void xhci_init() {
             // Allocate Scratchpad Buffer Array (must be 64-byte aligned, pfa_alloc gives 4KB alignment)
             // Use pfa_alloc_low to get memory below 4GB that's identity mapped
             kprintf("xHCI: Allocating scratchpad array page...\n", 0x00FF0000);
-            uint64_t scratchpad_array_phys = pfa_alloc_low();
+            uint64_t scratchpad_array_phys = pfa_alloc_low_zeroed();
             if (scratchpad_array_phys == 0) {
                 kprintf("xHCI: Failed to allocate scratchpad array!\n", 0xFF0000);
                 xhci_dcbaap_array[0] = 0;
@@ -477,14 +477,11 @@ void xhci_init() {
                 uint64_t *scratchpad_array_virt = (uint64_t*)phys_to_virt(scratchpad_array_phys);
                 kprintf("xHCI: Scratchpad array virt=0x%lx\n", 0x00FF0000, (uint64_t)scratchpad_array_virt);
                 
-                // Clear the array
-                custom_memset(scratchpad_array_virt, 0, 4096); 
-                
                 kprintf("xHCI: Allocating %u scratchpad pages...\n", 0x00FF0000, max_scratchpad_bufs);
                 for (uint32_t i = 0; i < max_scratchpad_bufs; i++) {
-                    // Scratchpad pages can be any memory - xHCI accesses them via DMA
-                    // But their addresses go into scratchpad_array_virt which we write via CPU
-                    uint64_t scratchpad_page_phys = pfa_alloc();  // Can be any memory for DMA
+                    // The controller owns these pages; keep them below 4 GiB, since
+                    // a controller without AC64 cannot address anything higher
+                    uint64_t scratchpad_page_phys = pfa_alloc_low();
                     if (scratchpad_page_phys == 0) {
                         kprintf("xHCI: Failed to allocate scratchpad page %u\n", 0xFF0000, i);
                         break;
@@ -570,15 +567,10 @@ void xhci_init() {
         xhci_op_regs->usbcmd |= (1 << 0);
 
         // Wait for Controller Halted (HCH) bit (bit 0) in USBSTS to clear
-        int hch_timeout = 1000000; // ~1 second timeout
-        while (xhci_op_regs->usbsts & (1 << 0)) { // HCH bit is 0 when running
-            // Simple busy-wait loop for now.
-            for (volatile int i = 0; i < 100; i++); 
-            hch_timeout--;
-            if (hch_timeout <= 0) {
-                kprintf("xHCI: Controller start timeout! USBSTS=0x%x\n", 0xFF0000, xhci_op_regs->usbsts);
-                return;
-            }
+        // HCH bit is 0 when running
+        if (!timer_poll_until(!(xhci_op_regs->usbsts & (1 << 0)), XHCI_START_TIMEOUT_US, XHCI_POLL_US)) {
+            kprintf("xHCI: Controller start timeout! USBSTS=0x%x\n", 0xFF0000, xhci_op_regs->usbsts);
+            return;
         }
         kprintf("xHCI: Controller started successfully.\n", 0x00FF0000);
 
@@ -603,7 +595,7 @@ void xhci_init() {
         
         // Wait for ports to stabilize (real hardware needs 100ms+ per USB spec)
         kprintf("xHCI: Waiting for port stabilization...\n", 0x00FF0000);
-        for (volatile int delay = 0; delay < 5000000; delay++);  // ~100-500ms delay
+        timer_sleep_ms(100);
 
         // Second pass: Scan for connected devices
         for (uint32_t i = 0; i < max_ports; i++) {
@@ -623,7 +615,7 @@ void xhci_init() {
                     kprintf("xHCI: Powering on Port %d...\n", 0x00FF0000, port_id);
                     *portsc_reg = portsc_val | (1 << 9); // Set PP bit
                     // Read back to ensure write took effect and allow time
-                    for (volatile int delay = 0; delay < 1000; delay++); 
+                    timer_sleep_ms(20);
                     portsc_val = *portsc_reg;
                     kprintf("xHCI: Port %d PORTSC after power on: 0x%x\n", 0x00FF0000, port_id, portsc_val);
                 }
@@ -635,16 +627,10 @@ void xhci_init() {
                 *portsc_reg |= (1 << 4); // Set Port Reset bit
 
                 // Wait for Port Reset Change (PRC - bit 21) to be set, indicating reset complete
-                int port_reset_timeout = 1000000; // ~1 second timeout
-                while (!(*portsc_reg & (1 << 21))) {
-                    for (volatile int delay = 0; delay < 100; delay++);
-                    port_reset_timeout--;
-                    if (port_reset_timeout <= 0) {
-                        kprintf("xHCI: Port %d reset timeout!\n", 0xFF0000, port_id);
-                        break;
-                    }
+                if (!timer_poll_until(*portsc_reg & (1 << 21), XHCI_PORT_RESET_TIMEOUT_US, XHCI_POLL_US)) {
+                    kprintf("xHCI: Port %d reset timeout!\n", 0xFF0000, port_id);
+                    continue;
                 }
-                if (port_reset_timeout <= 0) continue;
 
                 kprintf("xHCI: Port %u reset complete. PORTSC=0x%x\n", 0x00FF0000, port_id, *portsc_reg);
                 
@@ -902,7 +888,7 @@ static void xhci_set_boot_protocol(uint32_t slot_id) {
     xhci_doorbell_regs[slot_id] = 1;
     
     // Wait briefly for completion
-    for (volatile int i = 0; i < 100000; i++);
+    timer_sleep_ms(1);
     
     kprintf("xHCI: SET_PROTOCOL sent.\n", 0x00FF00);
 }
@@ -2,12 +2,17 @@
 #include "include/vfs.h"
 #include "include/ahci.h"
 #include "include/mm.h"
+#include "include/slab.h"
 #include "include/stdio.h"
 #include <stdint.h>
 #include <stddef.h>
 
 extern void kprintf(const char *format, uint32_t color, ...);
 
+// Object caches for the per-entry metadata created by lookups
+static kmem_cache_t *fat32_node_cache;
+static kmem_cache_t *fat32_data_cache;
+
 // String helpers
 static size_t my_strlen(const char *s) {
     size_t len = 0;
@@ -37,6 +42,21 @@ static int my_strncmp(const char *s1, const char *s2, size_t n) {
     return *(unsigned char*)s1 - *(unsigned char*)s2;
 }
 
+// Page-sized sector/cluster buffers, addressed through the direct map
+static uint8_t *fat32_alloc_page(void) {
+    uint64_t phys = pfa_alloc();
+    return phys ? (uint8_t*)phys_to_virt(phys) : NULL;
+}
+
+static uint8_t *fat32_alloc_zeroed_page(void) {
+    uint64_t phys = pfa_alloc_zeroed();
+    return phys ? (uint8_t*)phys_to_virt(phys) : NULL;
+}
+
+static void fat32_free_page(void *buf) {
+    if (buf) pfa_free(virt_to_phys(buf));
+}
+
 // FAT32 helpers
 static uint32_t fat32_get_fat_entry(struct fat32_fs *fs, uint32_t cluster) {
     if (!fs->fat_cache_valid) {
@@ -197,12 +217,12 @@ static int fat32_read(struct vfs_node *node, uint64_t offset, uint32_t size, uin
     }
     
     uint32_t cluster_offset = offset % cluster_size;
-    uint8_t *cluster_buf = (uint8_t*)pfa_alloc();
+    uint8_t *cluster_buf = fat32_alloc_page();
     
     while (size > 0 && current_cluster < 0x0FFFFFF8) {
         // Read cluster
         if (fat32_read_cluster(fs, current_cluster, cluster_buf) != 0) {
-            pfa_free((uint64_t)cluster_buf);
+            fat32_free_page(cluster_buf);
             return bytes_read;
         }
         
@@ -217,7 +237,7 @@ static int fat32_read(struct vfs_node *node, uint64_t offset, uint32_t size, uin
         current_cluster = fat32_get_fat_entry(fs, current_cluster);
     }
     
-    pfa_free((uint64_t)cluster_buf);
+    fat32_free_page(cluster_buf);
     return bytes_read;
 }
 
@@ -254,7 +274,7 @@ static int fat32_write(struct vfs_node *node, uint64_t offset, uint32_t size, co
     }
     
     uint32_t cluster_offset = offset % cluster_size;
-    uint8_t *cluster_buf = (uint8_t*)pfa_alloc();
+    uint8_t *cluster_buf = fat32_alloc_page();
     
     while (size > 0) {
         // Read existing cluster data (for partial writes)
@@ -269,7 +289,7 @@ static int fat32_write(struct vfs_node *node, uint64_t offset, uint32_t size, co
         
         // Write cluster back
         if (fat32_write_cluster(fs, current_cluster, cluster_buf) != 0) {
-            pfa_free((uint64_t)cluster_buf);
+            fat32_free_page(cluster_buf);
             return bytes_written;
         }
         
@@ -285,14 +305,14 @@ static int fat32_write(struct vfs_node *node, uint64_t offset, uint32_t size, co
             if (current_cluster >= 0x0FFFFFF8) {
                 current_cluster = fat32_extend_chain(fs, prev_cluster);
                 if (current_cluster == 0) {
-                    pfa_free((uint64_t)cluster_buf);
+                    fat32_free_page(cluster_buf);
                     return bytes_written;
                 }
             }
         }
     }
     
-    pfa_free((uint64_t)cluster_buf);
+    fat32_free_page(cluster_buf);
     
     // Update file size if we wrote past end
     if (offset + bytes_written > node->size) {
@@ -354,7 +374,7 @@ static struct vfs_node* fat32_finddir(struct vfs_node *node, const char *name) {
     uint32_t cluster_size = fs->bs.bytes_per_sector * fs->bs.sectors_per_cluster;
     uint32_t entries_per_cluster = cluster_size / sizeof(struct fat32_dir_entry);
     
-    uint8_t *cluster_buf = (uint8_t*)pfa_alloc();
+    uint8_t *cluster_buf = fat32_alloc_page();
     if (!cluster_buf) return NULL;
 
     // Buffer for LFN
@@ -364,7 +384,7 @@ static struct vfs_node* fat32_finddir(struct vfs_node *node, const char *name) {
 
     while (cluster < 0x0FFFFFF8) {
         if (fat32_read_cluster(fs, cluster, cluster_buf) != 0) {
-            pfa_free((uint64_t)cluster_buf);
+            fat32_free_page(cluster_buf);
             return NULL;
         }
 
@@ -374,7 +394,7 @@ static struct vfs_node* fat32_finddir(struct vfs_node *node, const char *name) {
 
             // End of directory
             if (entry->name[0] == 0x00) {
-                pfa_free((uint64_t)cluster_buf);
+                fat32_free_page(cluster_buf);
                 return NULL;
             }
 
@@ -430,7 +450,14 @@ static struct vfs_node* fat32_finddir(struct vfs_node *node, const char *name) {
             
             if (match) {
                 // Found it! Create VFS node
-                struct vfs_node *child = (struct vfs_node*)pfa_alloc();
+                struct vfs_node *child = kmem_cache_alloc(fat32_node_cache);
+                struct fat32_node_data *child_data = kmem_cache_alloc(fat32_data_cache);
+                if (!child || !child_data) {
+                    kmem_cache_free(fat32_node_cache, child);
+                    kmem_cache_free(fat32_data_cache, child_data);
+                    fat32_free_page(cluster_buf);
+                    return NULL;
+                }
                 my_memset(child, 0, sizeof(struct vfs_node));
                 
                 // Prefer LFN name
@@ -452,13 +479,12 @@ static struct vfs_node* fat32_finddir(struct vfs_node *node, const char *name) {
                 child->create = fat32_create;
                 child->mkdir = fat32_mkdir_op; 
                 
-                struct fat32_node_data *child_data = (struct fat32_node_data*)pfa_alloc();
                 child_data->first_cluster = ((uint32_t)entry->first_cluster_high << 16) | entry->first_cluster_low;
                 child_data->parent_cluster = data->first_cluster;
                 child_data->fs = fs;
                 child->fs_data = child_data;
                 
-                pfa_free((uint64_t)cluster_buf);
+                fat32_free_page(cluster_buf);
                 return child;
             }
             
@@ -470,7 +496,7 @@ static struct vfs_node* fat32_finddir(struct vfs_node *node, const char *name) {
         cluster = fat32_get_fat_entry(fs, cluster);
     }
     
-    pfa_free((uint64_t)cluster_buf);
+    fat32_free_page(cluster_buf);
     return NULL;
 }
 
@@ -491,7 +517,7 @@ static struct vfs_node* fat32_readdir(struct vfs_node *node, uint32_t index) {
     int lfn_checksum = -1;
     
     // Allocate cluster buffer
-    uint8_t *cluster_buf = (uint8_t*)pfa_alloc();
+    uint8_t *cluster_buf = fat32_alloc_page();
     if (!cluster_buf) return NULL;
     
     // Note: This naive index skipping is problematic for LFN because LFNs take up multiple slots.
@@ -502,7 +528,7 @@ static struct vfs_node* fat32_readdir(struct vfs_node *node, uint32_t index) {
     
     while (cluster < 0x0FFFFFF8) {
         if (fat32_read_cluster(fs, cluster, cluster_buf) != 0) {
-            pfa_free((uint64_t)cluster_buf);
+            fat32_free_page(cluster_buf);
             return NULL;
         }
         
@@ -512,7 +538,7 @@ static struct vfs_node* fat32_readdir(struct vfs_node *node, uint32_t index) {
             
             // End of dir
             if (entry->name[0] == 0x00) {
-                pfa_free((uint64_t)cluster_buf);
+                fat32_free_page(cluster_buf);
                 return NULL;
             }
             
@@ -553,7 +579,14 @@ static struct vfs_node* fat32_readdir(struct vfs_node *node, uint32_t index) {
             // Found a valid file/dir
             if (current_file_idx == index) {
                 // Return this one
-                 struct vfs_node *child = (struct vfs_node*)pfa_alloc();
+                 struct vfs_node *child = kmem_cache_alloc(fat32_node_cache);
+                 struct fat32_node_data *child_data = kmem_cache_alloc(fat32_data_cache);
+                 if (!child || !child_data) {
+                     kmem_cache_free(fat32_node_cache, child);
+                     kmem_cache_free(fat32_data_cache, child_data);
+                     fat32_free_page(cluster_buf);
+                     return NULL;
+                 }
                  my_memset(child, 0, sizeof(struct vfs_node));
                  
                  // Use LFN if valid
@@ -581,13 +614,12 @@ static struct vfs_node* fat32_readdir(struct vfs_node *node, uint32_t index) {
                  child->create = fat32_create;
                  child->mkdir = fat32_mkdir_op; 
                  
-                 struct fat32_node_data *child_data = (struct fat32_node_data*)pfa_alloc();
                  child_data->first_cluster = ((uint32_t)entry->first_cluster_high << 16) | entry->first_cluster_low;
                  child_data->parent_cluster = data->first_cluster;
                  child_data->fs = fs;
                  child->fs_data = child_data;
                  
-                 pfa_free((uint64_t)cluster_buf);
+                 fat32_free_page(cluster_buf);
                  return child;
             }
             
@@ -601,7 +633,7 @@ static struct vfs_node* fat32_readdir(struct vfs_node *node, uint32_t index) {
         cluster = fat32_get_fat_entry(fs, cluster);
     }
     
-    pfa_free((uint64_t)cluster_buf);
+    fat32_free_page(cluster_buf);
     return NULL;
 }
 
@@ -696,7 +728,7 @@ static int fat32_create_entry(struct vfs_node *parent, const char *name, uint8_t
     uint32_t cluster_size = fs->bs.bytes_per_sector * fs->bs.sectors_per_cluster;
     uint32_t entries_per_cluster = cluster_size / sizeof(struct fat32_dir_entry);
     
-    uint8_t *cluster_buf = (uint8_t*)pfa_alloc();
+    uint8_t *cluster_buf = fat32_alloc_page();
     if (!cluster_buf) return -1;
     
     uint32_t target_cluster = 0;
@@ -705,7 +737,7 @@ static int fat32_create_entry(struct vfs_node *parent, const char *name, uint8_t
     
     while (cluster < 0x0FFFFFF8) {
         if (fat32_read_cluster(fs, cluster, cluster_buf) != 0) {
-            pfa_free((uint64_t)cluster_buf);
+            fat32_free_page(cluster_buf);
             return -1;
         }
         
@@ -743,7 +775,7 @@ static int fat32_create_entry(struct vfs_node *parent, const char *name, uint8_t
              // Extend directory
              uint32_t new_cluster = fat32_extend_chain(fs, cluster);
              if (new_cluster == 0) {
-                 pfa_free((uint64_t)cluster_buf);
+                 fat32_free_page(cluster_buf);
                  return -1;
              }
              my_memset(cluster_buf, 0, 4096);
@@ -759,7 +791,7 @@ static int fat32_create_entry(struct vfs_node *parent, const char *name, uint8_t
     }
     
     if (!found_consecutive) {
-        pfa_free((uint64_t)cluster_buf);
+        fat32_free_page(cluster_buf);
         return -1;
     }
     
@@ -768,12 +800,11 @@ static int fat32_create_entry(struct vfs_node *parent, const char *name, uint8_t
     if (attr & FAT_ATTR_DIRECTORY) {
         first_cluster = fat32_alloc_cluster(fs);
         if (first_cluster == 0) {
-            pfa_free((uint64_t)cluster_buf);
+            fat32_free_page(cluster_buf);
             return -1;
         }
         // Initialize new directory with . and ..
-        uint8_t *new_dir_buf = (uint8_t*)pfa_alloc();
-        my_memset(new_dir_buf, 0, 4096);
+        uint8_t *new_dir_buf = fat32_alloc_zeroed_page();
         struct fat32_dir_entry *dot = (struct fat32_dir_entry*)new_dir_buf;
         
         my_memset(dot[0].name, ' ', 11); dot[0].name[0] = '.'; dot[0].attr = FAT_ATTR_DIRECTORY;
@@ -787,7 +818,7 @@ static int fat32_create_entry(struct vfs_node *parent, const char *name, uint8_t
         dot[1].first_cluster_low = p & 0xFFFF;
         
         fat32_write_cluster(fs, first_cluster, new_dir_buf);
-        pfa_free((uint64_t)new_dir_buf);
+        fat32_free_page(new_dir_buf);
     }
     
     // Re-read cluster to be safe
@@ -844,7 +875,7 @@ static int fat32_create_entry(struct vfs_node *parent, const char *name, uint8_t
 
     // Write back
     fat32_write_cluster(fs, target_cluster, cluster_buf);
-    pfa_free((uint64_t)cluster_buf);
+    fat32_free_page(cluster_buf);
 
     return 0;
 }
@@ -859,8 +890,8 @@ static int fat32_create(struct vfs_node *parent, const char *name, uint32_t flag
         // If we wanted to be robust, we'd check if it's a dir vs file match etc.
         // For now, fail if anything exists with that name.
         // We must free the node returned by finddir since it was allocated!
-        if (existing->fs_data) pfa_free((uint64_t)existing->fs_data);
-        pfa_free((uint64_t)existing);
+        kmem_cache_free(fat32_data_cache, existing->fs_data);
+        kmem_cache_free(fat32_node_cache, existing);
         return -1; // EEXIST
     }
     
@@ -909,7 +940,7 @@ static int fat32_mount(const char *device, struct mount_point *mp) {
     
     kprintf("FAT32: Step 1 - Allocating FS structure\n", 0x0000FFFF);
     // Allocate filesystem private data
-    struct fat32_fs *fs = (struct fat32_fs*)pfa_alloc();
+    struct fat32_fs *fs = kmalloc(sizeof(struct fat32_fs));
     if (!fs) {
         kprintf("FAT32: Failed to allocate FS structure\n", 0xFFFF0000);
         return -1;
@@ -919,10 +950,10 @@ static int fat32_mount(const char *device, struct mount_point *mp) {
     
     kprintf("FAT32: Step 2 - Reading boot sector\n", 0x0000FFFF);
     // Read boot sector
-    uint8_t *boot_sector = (uint8_t*)pfa_alloc();
+    uint8_t *boot_sector = fat32_alloc_page();
     if (!boot_sector) {
         kprintf("FAT32: Failed to allocate boot sector buffer\n", 0xFFFF0000);
-        pfa_free((uint64_t)fs);
+        kfree(fs);
         return -1;
     }
     
@@ -933,15 +964,15 @@ static int fat32_mount(const char *device, struct mount_point *mp) {
     kprintf("FAT32: Step 3 - AHCI read sector 0\n", 0x0000FFFF);
     if (ahci_read_sectors(0, 1, boot_sector) != 0) {
         kprintf("FAT32: Failed to read boot sector\n", 0xFFFF0000);
-        pfa_free((uint64_t)boot_sector);
-        pfa_free((uint64_t)fs);
+        fat32_free_page(boot_sector);
+        kfree(fs);
         return -1;
     }
     kprintf("FAT32: Boot sector read successfully\n", 0x0000FFFF);
     
     kprintf("FAT32: Step 4 - Copying boot sector\n", 0x0000FFFF);
     my_memcpy(&fs->bs, boot_sector, sizeof(struct fat32_boot_sector));
-    pfa_free((uint64_t)boot_sector);
+    fat32_free_page(boot_sector);
     
     // Check UUID if requested
     if (device && my_strncmp(device, "UUID=", 5) == 0) {
@@ -970,7 +1001,7 @@ static int fat32_mount(const char *device, struct mount_point *mp) {
         
         if (fs->bs.volume_id != expected_id) {
             kprintf("FAT32: Volume ID mismatch!\n", 0xFFFF0000);
-            pfa_free((uint64_t)fs);
+            kfree(fs);
             return -1;
         }
     }
@@ -986,13 +1017,13 @@ static int fat32_mount(const char *device, struct mount_point *mp) {
     // Validate
     if (fs->bs.bytes_per_sector != 512) {
         kprintf("FAT32: Unsupported sector size: %d\n", 0xFFFF0000, fs->bs.bytes_per_sector);
-        pfa_free((uint64_t)fs);
+        kfree(fs);
         return -1;
     }
     
     if (fs->bs.sectors_per_cluster == 0 || fs->bs.sectors_per_cluster > 128) {
         kprintf("FAT32: Invalid sectors per cluster: %d\n", 0xFFFF0000, fs->bs.sectors_per_cluster);
-        pfa_free((uint64_t)fs);
+        kfree(fs);
         return -1;
     }
     
@@ -1019,18 +1050,18 @@ static int fat32_mount(const char *device, struct mount_point *mp) {
     uint32_t sectors_to_read = (fat_size_bytes > 4096) ? 8 : fs->bs.fat_size_32;
     
     kprintf("FAT32:   Allocating 1 page, reading %d sectors\n", 0x00FFFF00, sectors_to_read);
-    fs->fat_cache = (uint8_t*)pfa_alloc();
+    fs->fat_cache = fat32_alloc_page();
     if(!fs->fat_cache) {
         kprintf("FAT32: Failed to allocate FAT cache\n", 0xFFFF0000);
-        pfa_free((uint64_t)fs);
+        kfree(fs);
         return -1;
     }
     
     kprintf("FAT32: Step 8 - Reading FAT from disk\n", 0x0000FFFF);
     if (ahci_read_sectors(fs->fat_start_sector, sectors_to_read, fs->fat_cache) != 0) {
         kprintf("FAT32: Failed to read FAT\n", 0xFFFF0000);
-        pfa_free((uint64_t)fs->fat_cache);
-        pfa_free((uint64_t)fs);
+        fat32_free_page(fs->fat_cache);
+        kfree(fs);
         return -1;
     }
     fs->fat_cache_valid = 1;
@@ -1039,11 +1070,11 @@ static int fat32_mount(const char *device, struct mount_point *mp) {
     
     kprintf("FAT32: Step 9 - Creating root VFS node\n", 0x0000FFFF);
     // Create root VFS node
-    struct vfs_node *root = (struct vfs_node*)pfa_alloc();
+    struct vfs_node *root = kmem_cache_alloc(fat32_node_cache);
     if (!root) {
         kprintf("FAT32: Failed to allocate root node\n", 0xFFFF0000);
-        pfa_free((uint64_t)fs->fat_cache);
-        pfa_free((uint64_t)fs);
+        fat32_free_page(fs->fat_cache);
+        kfree(fs);
         return -1;
     }
     my_memset(root, 0, sizeof(struct vfs_node));
@@ -1062,12 +1093,12 @@ static int fat32_mount(const char *device, struct mount_point *mp) {
     root->mkdir = fat32_mkdir_op; 
     
     kprintf("FAT32: Step 10 - Creating root node data\n", 0x0000FFFF);
-    struct fat32_node_data *root_data = (struct fat32_node_data*)pfa_alloc();
+    struct fat32_node_data *root_data = kmem_cache_alloc(fat32_data_cache);
     if (!root_data) {
         kprintf("FAT32: Failed to allocate root node data\n", 0xFFFF0000);
-        pfa_free((uint64_t)root);
-        pfa_free((uint64_t)fs->fat_cache);
-        pfa_free((uint64_t)fs);
+        kmem_cache_free(fat32_node_cache, root);
+        fat32_free_page(fs->fat_cache);
+        kfree(fs);
         return -1;
     }
     root_data->first_cluster = fs->root_dir_cluster;
@@ -1089,5 +1120,7 @@ static int fat32_unmount(struct mount_point *mp) {
 }
 
 void fat32_register(void) {
+    fat32_node_cache = kmem_cache_create("fat32_node", sizeof(struct vfs_node), 0, NULL);
+    fat32_data_cache = kmem_cache_create("fat32_node_data", sizeof(struct fat32_node_data), 0, NULL);
     vfs_register_filesystem("fat32", fat32_mount, fat32_unmount);
 }
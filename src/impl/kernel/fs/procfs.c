@@ -1,5 +1,6 @@
 #include "include/vfs.h"
 #include "include/stdio.h"
+#include "include/slab.h"
 #include <stddef.h>
 
 extern void kprintf(const char *format, uint32_t color, ...);
@@ -7,8 +8,7 @@ extern void kprintf(const char *format, uint32_t color, ...);
 // Basic ProcFS implementation
 #define MAX_PROCFS_NODES 16
 static struct vfs_node procfs_root;
-static struct vfs_node procfs_nodes[MAX_PROCFS_NODES];
-static char procfs_content[MAX_PROCFS_NODES][256]; // Store small text content
+static kmem_cache_t *procfs_node_cache;
 static int procfs_node_count = 0;
 static struct vfs_node *procfs_children[MAX_PROCFS_NODES];
 
@@ -49,6 +49,32 @@ static int procfs_read(struct vfs_node *node, uint64_t offset, uint32_t count, u
     return read_len;
 }
 
+// Dynamic entries regenerate their text on every read
+#define PROCFS_DYNAMIC_SIZE 4096
+
+struct procfs_dynamic {
+    int (*show)(char *buf, int size);
+};
+
+static int procfs_read_dynamic(struct vfs_node *node, uint64_t offset, uint32_t count, uint8_t *buffer) {
+    struct procfs_dynamic *dyn = (struct procfs_dynamic*)node->fs_data;
+    if (!dyn) return 0;
+
+    char *text = kmalloc(PROCFS_DYNAMIC_SIZE);
+    if (!text) return 0;
+    int len = dyn->show(text, PROCFS_DYNAMIC_SIZE);
+    node->size = len;
+
+    int read_len = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (offset + i >= (uint64_t)len) break;
+        buffer[i] = text[offset + i];
+        read_len++;
+    }
+    kfree(text);
+    return read_len;
+}
+
 static int procfs_mount_op(const char *device, struct mount_point *mp) {
     (void)device;
     procfs_root.flags = VFS_DIRECTORY;
@@ -66,10 +92,19 @@ static int procfs_unmount_op(struct mount_point *mp) {
 
 // Add process entry
 void procfs_add_entry(const char *name, const char *content) {
-    if (procfs_node_count >= MAX_PROCFS_NODES) return;
+    if (procfs_node_count >= MAX_PROCFS_NODES || !procfs_node_cache) return;
     
-    struct vfs_node *node = &procfs_nodes[procfs_node_count];
-    char *store = procfs_content[procfs_node_count];
+    int len = 0;
+    while (content[len]) len++;
+
+    struct vfs_node *node = kmem_cache_alloc(procfs_node_cache);
+    char *store = kmalloc(len + 1);
+    if (!node || !store) {
+        kmem_cache_free(procfs_node_cache, node);
+        kfree(store);
+        return;
+    }
+    for (int k = 0; k < (int)sizeof(struct vfs_node); k++) ((char*)node)[k] = 0;
     
     // Copy name
     int i = 0;
@@ -80,22 +115,48 @@ void procfs_add_entry(const char *name, const char *content) {
     node->name[i] = '\0';
     
     // Copy content
-    i = 0;
-    while(content[i] && i < 255) {
-        store[i] = content[i];
-        i++;
-    }
-    store[i] = '\0';
+    for (i = 0; i <= len; i++) store[i] = content[i];
     
     node->flags = VFS_FILE;
     node->fs_data = (void*)store;
-    node->size = i;
+    node->size = len;
     node->read = procfs_read;
     
     procfs_children[procfs_node_count] = node;
     procfs_node_count++;
 }
 
+// Add an entry whose content is produced by show() at read time
+void procfs_add_dynamic(const char *name, int (*show)(char *buf, int size)) {
+    if (procfs_node_count >= MAX_PROCFS_NODES || !procfs_node_cache) return;
+
+    struct vfs_node *node = kmem_cache_alloc(procfs_node_cache);
+    struct procfs_dynamic *dyn = kmalloc(sizeof(struct procfs_dynamic));
+    if (!node || !dyn) {
+        kmem_cache_free(procfs_node_cache, node);
+        kfree(dyn);
+        return;
+    }
+    for (int k = 0; k < (int)sizeof(struct vfs_node); k++) ((char*)node)[k] = 0;
+
+    int i = 0;
+    while(name[i] && i < 31) {
+        node->name[i] = name[i];
+        i++;
+    }
+    node->name[i] = '\0';
+
+    dyn->show = show;
+    node->flags = VFS_FILE;
+    node->fs_data = (void*)dyn;
+    node->size = 0;
+    node->read = procfs_read_dynamic;
+
+    procfs_children[procfs_node_count] = node;
+    procfs_node_count++;
+}
+
 void procfs_register(void) {
+    procfs_node_cache = kmem_cache_create("procfs_node", sizeof(struct vfs_node), 0, NULL);
     vfs_register_filesystem("ProcessFS", procfs_mount_op, procfs_unmount_op);
 }
@@ -1,6 +1,7 @@
 #include "include/vfs.h"
 #include "include/vfs.h"
 #include "include/mm.h"
+#include "include/slab.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -20,34 +21,34 @@ typedef struct ramfs_node_data {
     struct vfs_node *children[RAMFS_MAX_CHILDREN];
 } ramfs_node_data_t;
 
-// Static memory pool for ramfs (no dynamic allocation)
-#define MAX_RAMFS_NODES 64
-static struct vfs_node ramfs_node_pool[MAX_RAMFS_NODES];
-static ramfs_node_data_t ramfs_data_pool[MAX_RAMFS_NODES]; // One data block per node (wasteful but safe)
-static int ramfs_node_count = 0;
+// Nodes come from their own object cache; only directories get a data block
+static kmem_cache_t *ramfs_node_cache;
 
 // Forward declaration
 int ramfs_mkdir_op(struct vfs_node *parent, const char *name);
 
-// Helper to create a new vfs_node from static pool
+// Helper to create a new vfs_node from the node cache
 static struct vfs_node* ramfs_alloc_node(const char *name, int flags) {
-    if (ramfs_node_count >= MAX_RAMFS_NODES) {
-        return NULL;  // Pool exhausted
+    struct vfs_node *node = kmem_cache_alloc(ramfs_node_cache);
+    if (!node) return NULL;
+
+    ramfs_node_data_t *data = NULL;
+    if (flags & VFS_DIRECTORY) {
+        data = kmalloc(sizeof(ramfs_node_data_t));
+        if (!data) {
+            kmem_cache_free(ramfs_node_cache, node);
+            return NULL;
+        }
+        // Clear data
+        for (int i = 0; i < RAMFS_MAX_CHILDREN; i++) {
+            data->children[i] = NULL;
+            data->child_names[i][0] = '\0';
+        }
     }
     
-    int index = ramfs_node_count++;
-    struct vfs_node *node = &ramfs_node_pool[index];
-    ramfs_node_data_t *data = &ramfs_data_pool[index];
-    
     // Clear node
     for (int i = 0; i < (int)sizeof(struct vfs_node); i++) ((char*)node)[i] = 0;
     
-    // Clear data
-    for (int i = 0; i < RAMFS_MAX_CHILDREN; i++) {
-        data->children[i] = NULL;
-        data->child_names[i][0] = '\0';
-    }
-    
     // Copy name
     int i = 0;
     while(name[i] && i < 255) {
@@ -59,12 +60,8 @@ static struct vfs_node* ramfs_alloc_node(const char *name, int flags) {
     node->flags = flags;
     node->size = 0;
     
-    // Assign data block if directory
-    if (flags & VFS_DIRECTORY) {
-        node->fs_data = (void*)data;
-    } else {
-        node->fs_data = NULL; // Files don't have data in this simplified version yet
-    }
+    // Files don't have data in this simplified version yet
+    node->fs_data = (void*)data;
     
     return node;
 }
@@ -181,5 +178,6 @@ static int ramfs_unmount_op(struct mount_point *mp) {
 }
 
 void ramfs_register(void) {
+    ramfs_node_cache = kmem_cache_create("ramfs_node", sizeof(struct vfs_node), 0, NULL);
     vfs_register_filesystem("ramfs", ramfs_mount_op, ramfs_unmount_op);
 }
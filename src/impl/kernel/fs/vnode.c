@@ -4,23 +4,14 @@
 #include <stdint.h>
 #include "include/autoconf.h"
 #include "include/vray.h"
+#include "include/slab.h"
 
 // Forward declaration for kprintf
 extern void kprintf(const char *format, uint32_t color, ...);
 
-#define MAX_VNODES 256
-
-static vnode_t vnode_pool[MAX_VNODES];
-static int next_vnode_index = 0;
-
-// Custom implementation of memset
-static void *custom_memset(void *s, int c, size_t n) {
-    unsigned char *p = s;
-    while (n-- > 0) {
-        *p++ = (unsigned char)c;
-    }
-    return s;
-}
+static kmem_cache_t *vnode_cache;
+static vnode_t *vnode_list_head = NULL;
+static vnode_t *vnode_list_tail = NULL;
 
 // Custom implementation of strcpy
 static char *custom_strcpy(char *dest, const char *src) {
@@ -30,32 +21,34 @@ static char *custom_strcpy(char *dest, const char *src) {
 }
 
 void vnode_init() {
-    custom_memset(vnode_pool, 0, sizeof(vnode_pool));
-    next_vnode_index = 0;
+    vnode_cache = kmem_cache_create("vnode", sizeof(vnode_t), 0, NULL);
+    vnode_list_head = vnode_list_tail = NULL;
     kprintf("VNode subsystem initialized.\n", 0x00FF0000);
 }
 
 vnode_t *vnode_create(device_type_t type, void *driver_data) {
-    if (next_vnode_index >= MAX_VNODES) {
+    vnode_t *new_node = vnode_cache ? kmem_cache_alloc(vnode_cache) : NULL;
+    if (!new_node) {
         // Out of VNodes
         return NULL;
     }
 
-    vnode_t *new_node = &vnode_pool[next_vnode_index++];
-
     custom_strcpy(new_node->name, "VNODE");
     
     new_node->type = type;
     new_node->driver_data = driver_data;
-    new_node->next = NULL; // This field is not really used with a static array, but we keep it for the struct definition
+    new_node->next = NULL;
+
+    // Keep creation order for the device list
+    if (vnode_list_tail) vnode_list_tail->next = new_node;
+    else vnode_list_head = new_node;
+    vnode_list_tail = new_node;
 
     return new_node;
 }
 
-// This function is no longer needed with a static array, but we keep it for API compatibility.
+// Registration is implicit in creation; kept for API compatibility.
 void vnode_register(vnode_t *node) {
-    // With a static pool, registration is implicit in creation.
-    // This function can be a no-op.
     if (!node) return;
 }
 
@@ -78,8 +71,8 @@ void vnode_populate_from_pci() {
 
 void vnode_dump_list() {
     kprintf("--- VNode Device List ---\n", 0x00FF0000);
-    for (int i = 0; i < next_vnode_index; i++) {
-        vnode_t *current = &vnode_pool[i];
+    int i = 0;
+    for (vnode_t *current = vnode_list_head; current; current = current->next, i++) {
         kprintf("  %d: %s (Type: %d)", 0x00FF0000, i, current->name, current->type);
         // All VNodes created from PCI devices will have their driver_data pointing to a vray_device
         #ifdef CONFIG_VRAY
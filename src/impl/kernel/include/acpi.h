@@ -165,6 +165,37 @@ struct madt_interrupt_override {
     uint16_t flags;
 } __attribute__((packed));
 
+// Interrupt source override flags (MPS INTI flags)
+#define MADT_POLARITY_MASK   0x3
+#define MADT_POLARITY_LOW    0x3
+#define MADT_TRIGGER_MASK    0xC
+#define MADT_TRIGGER_LEVEL   0xC
+
+// What acpi_parse_madt records about the I/O APICs and ISA IRQ overrides
+#define ACPI_MAX_IOAPICS 8
+
+struct acpi_ioapic_info {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;
+};
+
+struct acpi_irq_override {
+    uint8_t present;
+    uint32_t gsi;
+    uint16_t flags;
+};
+
+// High Precision Event Timer description table ("HPET")
+struct acpi_hpet {
+    struct acpi_sdt_header header;
+    uint32_t event_timer_block_id;  // Hardware revision, timer count, vendor
+    struct acpi_gas base_address;
+    uint8_t hpet_number;
+    uint16_t minimum_tick;          // Smallest periodic interval without lost interrupts
+    uint8_t page_protection;
+} __attribute__((packed));
+
 // --------------------------------------------------------------------------
 // ACPI Functions
 // --------------------------------------------------------------------------
@@ -0,0 +1,22 @@
+#ifndef KERNEL_GDT_H
+#define KERNEL_GDT_H
+
+#include <stdint.h>
+
+// Selectors. The user segments are laid out the way SYSRET expects them
+// relative to the STAR value syscall_init programs.
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE32 0x18
+#define GDT_USER_DATA   0x20
+#define GDT_USER_CODE   0x28
+#define GDT_TSS         0x30
+
+// Build and load the GDT and TSS of one CPU. kernel_stack becomes the
+// TSS RSP0 (the stack used on entry from ring 3).
+void gdt_init_cpu(uint32_t cpu, uint64_t kernel_stack);
+
+// Update RSP0 when a different task starts running on the CPU
+void gdt_set_kernel_stack(uint32_t cpu, uint64_t kernel_stack);
+
+#endif // KERNEL_GDT_H
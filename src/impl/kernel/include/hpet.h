@@ -0,0 +1,32 @@
+#ifndef KERNEL_HPET_H
+#define KERNEL_HPET_H
+
+#include <stdint.h>
+
+// Find the HPET through its ACPI table, map it and start the main counter.
+// Returns -1 if there is none. Requires acpi_init.
+int hpet_init(void);
+
+int hpet_available(void);
+
+// Main counter. It runs at hpet_frequency() Hz regardless of CPU power
+// state; hpet_counter_mask() is all ones for a 64-bit counter and
+// 0xFFFFFFFF for a 32-bit one, so differences must be masked.
+uint64_t hpet_read_counter(void);
+uint64_t hpet_frequency(void);
+uint64_t hpet_counter_mask(void);
+uint64_t hpet_ticks_to_ns(uint64_t ticks);
+
+// Spin until `ns` nanoseconds of HPET time have passed
+void hpet_ndelay(uint64_t ns);
+
+// Comparators. Each fires an interrupt on a global system interrupt
+// (IO-APIC input) it can be routed to, once after delta_ns or every
+// period_ns. Return -1 if the timer does not exist, cannot be routed to
+// gsi, or cannot do periodic mode.
+int hpet_timer_count(void);
+int hpet_timer_oneshot(int timer, uint64_t delta_ns, uint32_t gsi);
+int hpet_timer_periodic(int timer, uint64_t period_ns, uint32_t gsi);
+void hpet_timer_stop(int timer);
+
+#endif // KERNEL_HPET_H
@@ -3,3 +3,4 @@
 #include <stdint.h>
 
 void init_idt(void);
+void idt_load(void);
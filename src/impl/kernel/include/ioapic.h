@@ -0,0 +1,25 @@
+#ifndef KERNEL_IOAPIC_H
+#define KERNEL_IOAPIC_H
+
+#include <stdint.h>
+
+// Map every I/O APIC listed in the MADT and mask all of its inputs.
+// Returns -1 if there is none. Requires acpi_init and mmio_remap.
+int ioapic_init(void);
+
+// Number of the global system interrupt an ISA IRQ arrives on, after the
+// MADT's interrupt source overrides, and whether that input is
+// level-triggered / active-low
+uint32_t ioapic_isa_to_gsi(uint8_t irq, int *level, int *active_low);
+
+// Deliver `gsi` as `vector` to the CPU with APIC ID `dest` (fixed
+// delivery, physical destination). The entry starts masked if `masked`.
+// Returns -1 if no I/O APIC has that input.
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t dest, int level, int active_low, int masked);
+
+void ioapic_set_masked(uint32_t gsi, int masked);
+
+// Move an input to another CPU without changing the rest of its entry
+int ioapic_set_dest(uint32_t gsi, uint32_t dest);
+
+#endif // KERNEL_IOAPIC_H
@@ -2,5 +2,21 @@
 
 #include <stdint.h>
 
+// ISA IRQ n arrives on vector IRQ_VECTOR_BASE + n, from either controller
+#define IRQ_VECTOR_BASE 0x20
+
 // Called from assembly IRQ stubs with IRQ number (0..15)
 void irq_handler(int irq);
+
+// Move the ISA IRQs from the 8259 PICs to the I/O APIC, all delivered to
+// the calling CPU (the BSP), keeping enabled what the PIC had enabled.
+// Requires lapic_init; without an I/O APIC the PICs stay in charge.
+void irq_init(void);
+
+// Enable or disable an ISA IRQ on whichever controller delivers it
+void irq_mask(int irq);
+void irq_unmask(int irq);
+
+// Deliver an ISA IRQ to another CPU. Returns -1 with the 8259, which can
+// only interrupt the BSP.
+int irq_set_affinity(int irq, uint32_t cpu);
@@ -0,0 +1,54 @@
+#ifndef KERNEL_KTIMER_H
+#define KERNEL_KTIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Kernel timers: run a callback once a given uptime has passed. Each CPU
+// keeps a hierarchical timer wheel of 5 levels of 64 slots, the first
+// level 2^10 ns (about 1 us) per slot and each next one 64 times coarser,
+// so adding and cancelling a timer is O(1). The wheel is advanced from the
+// timer interrupt; an idle CPU programs a wakeup for its earliest timer.
+typedef struct ktimer {
+    void (*fn)(struct ktimer *timer);
+    struct ktimer *next;
+    struct ktimer **pprev;      // Link pointing at this timer, for O(1) removal
+    uint64_t expires;           // In wheel units (2^10 ns)
+    int32_t cpu;                // Wheel the timer is on, -1 if not pending
+    uint16_t slot;              // level * 64 + index within the level
+} ktimer_t;
+
+#define KTIMER_INIT(f) { (f), NULL, NULL, 0, -1, 0 }
+
+static inline void ktimer_init(ktimer_t *timer, void (*fn)(ktimer_t *)) {
+    timer->fn = fn;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->cpu = -1;
+    timer->slot = 0;
+}
+
+// Arm `timer` on the calling CPU to fire once uptime reaches expiry_ns
+// (rounded up to the wheel's resolution). A pending timer is moved to the
+// new expiry. The callback runs in interrupt context with interrupts off
+// and may add its timer again.
+void timer_add(ktimer_t *timer, uint64_t expiry_ns);
+
+// Take a pending timer off its wheel. Returns 1 if it was pending, 0 if it
+// had already fired (its callback may still be running on another CPU).
+int timer_cancel(ktimer_t *timer);
+
+static inline int timer_pending(const ktimer_t *timer) {
+    return __atomic_load_n(&timer->cpu, __ATOMIC_ACQUIRE) >= 0;
+}
+
+// timer_cancel, then wait for a callback already running on another CPU
+// to return, after which the timer may be reused or freed. Must not be
+// called from the timer's own callback.
+int timer_cancel_sync(ktimer_t *timer);
+
+// Run the calling CPU's expired timers. Called from the timer interrupt.
+void timer_wheel_run(uint64_t now_ns);
+
+#endif // KERNEL_KTIMER_H
@@ -0,0 +1,50 @@
+#ifndef KERNEL_LAPIC_H
+#define KERNEL_LAPIC_H
+
+#include <stdint.h>
+
+// Vector the local APIC delivers spurious interrupts on (low nibble all ones)
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// Local timer interrupt vector
+#define LAPIC_TIMER_VECTOR    0xEF
+
+// Map the local APIC (address from the MADT) and enable it on the BSP.
+// Returns -1 if there is no usable local APIC.
+int lapic_init(void);
+
+// Enable the local APIC of the calling CPU. Used by each AP as it starts.
+void lapic_cpu_init(void);
+
+// APIC ID of the calling CPU
+uint32_t lapic_id(void);
+
+// Signal end of interrupt for a LAPIC-delivered vector
+void lapic_eoi(void);
+
+// Fixed-delivery IPI to one CPU, or to every CPU but the caller
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_send_ipi_others(uint8_t vector);
+
+// AP startup sequence: INIT, then STARTUP at physical page `page` (addr >> 12)
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint8_t page);
+
+// Local timer modes (the LVT timer mode field)
+#define LAPIC_TIMER_ONESHOT      0
+#define LAPIC_TIMER_PERIODIC     1
+#define LAPIC_TIMER_TSC_DEADLINE 2
+
+// Local timer. The count runs at the bus clock divided by 16; a count of 0
+// (or lapic_timer_stop) disarms it. A periodic count reloads each time it
+// reaches zero. TSC-deadline mode, where supported, fires when the TSC
+// reaches the given value instead.
+int lapic_has_tsc_deadline(void);
+void lapic_timer_setup(int mode);
+void lapic_timer_oneshot(uint32_t count);
+void lapic_timer_periodic(uint32_t count);
+void lapic_timer_deadline(uint64_t tsc);
+void lapic_timer_stop(void);
+uint32_t lapic_timer_current(void);
+
+#endif // KERNEL_LAPIC_H
@@ -8,18 +8,99 @@
 void mm_init(uint64_t multiboot_addr);
 
 // Maps a region of physical memory into the kernel's MMIO virtual address space.
-// Returns the virtual address.
+// Returns the virtual address, or NULL if it could not be mapped.
 void *mmio_remap(uint64_t physical_addr, size_t size);
 
+// Like mmio_remap, but write-combining (framebuffers, prefetchable BARs).
+// Always maps into the MMIO window, also below 4 GiB, and removes the
+// write-back identity mapping of the range: the physical address must no
+// longer be used as a pointer, and mmio_unmap does not bring it back.
+void *mmio_remap_wc(uint64_t physical_addr, size_t size);
+
+// Release a mapping made by mmio_remap or mmio_remap_wc
+void mmio_unmap(void *virt, size_t size);
+
+// Page table entry flags
+#define PAGE_PRESENT (1 << 0)
+#define PAGE_RW      (1 << 1)
+#define PAGE_USER    (1 << 2)
+#define PAGE_PWT     (1 << 3)
+#define PAGE_PCD     (1 << 4) // Page Cache Disable
+#define PAGE_PAT     (1 << 7) // PAT bit of a 4 KiB PTE
+#define PAGE_NO_EXEC (1ULL << 63)
+
+// Write-combining: selects PAT entry 4, which mm_pat_init programs as WC.
+// Falls back to uncached on CPUs without PAT.
+#define PAGE_WC      PAGE_PAT
+
+// Program IA32_PAT on the calling CPU. mm_init does this for the BSP.
+void mm_pat_init(void);
+
+// Map npages consecutive 4KB pages of phys at virt in the current address
+// space, creating page tables as needed. 2 MiB and 1 GiB pages are used
+// wherever phys and virt alignment allow. The changed entries are then
+// invalidated (invlpg each, or one full flush for many). Returns 0 on success.
+int map_range(uint64_t phys, uint64_t virt, size_t npages, uint64_t flags);
+
+// Clear the mappings for npages pages at virt and invalidate them. Large
+// pages inside the range are removed whole.
+void unmap_range(uint64_t virt, size_t npages);
+
+// Per-CPU TLB invalidation counters. Returns the length written.
+int mm_format_tlb_stats(char *buf, int size);
+
+// Invalidate `count` pages (or the whole TLB if `full`) on the calling CPU
+void mm_tlb_invalidate(const uint64_t *addrs, uint32_t count, int full);
+
+// Largest block the buddy allocator hands out: 2^PFA_MAX_ORDER pages (16 MiB).
+#define PFA_MAX_ORDER 12
+
 // Allocate a physical frame (4KB page). Returns physical address.
+// Prefers memory above 4 GiB and falls back to the DMA32 zone.
 uint64_t pfa_alloc(void);
 
-// Allocate a physical frame from low memory (<4GB, identity mapped)
+// Allocate 2^order physically contiguous frames aligned to their size.
+// Returns the physical address of the first frame, or 0 if none is available.
+uint64_t pfa_alloc_pages(uint32_t order);
+
+// Same as pfa_alloc_pages, but only from the DMA32 zone (below 4 GiB)
+uint64_t pfa_alloc_pages_low(uint32_t order);
+
+// Free a block obtained from pfa_alloc_pages; order must match the allocation.
+void pfa_free_pages(uint64_t paddr, uint32_t order);
+
+// Allocate ceil(size / PAGE_SIZE) contiguous frames, returning the unused
+// tail of the underlying power-of-two block. Returns 0 on failure.
+uint64_t pfa_alloc_pages_exact(size_t size);
+
+// Free frames obtained from pfa_alloc_pages_exact; size must match.
+void pfa_free_pages_exact(uint64_t paddr, size_t size);
+
+// Order of the allocated block starting at paddr
+uint32_t pfa_block_order(uint64_t paddr);
+
+// Smallest order whose block covers size bytes
+uint32_t pfa_order_for_size(size_t size);
+
+// Allocate a physical frame from the DMA32 zone (<4GB, identity mapped)
 uint64_t pfa_alloc_low(void);
 
+// Allocate a zeroed frame, preferring pages the idle loop has already
+// cleared. pfa_alloc_low_zeroed is the DMA32-only variant (page tables).
+uint64_t pfa_alloc_zeroed(void);
+uint64_t pfa_alloc_low_zeroed(void);
+
+// Zero up to budget free frames into the pre-zeroed pool. Called from the
+// idle loop; returns how many frames were zeroed (0 when the pool is full).
+int pfa_zero_idle(uint32_t budget);
+
 // Free a physical frame
 void pfa_free(uint64_t paddr);
 
+// Zone free counts followed by per-CPU magazine counters (cached frames,
+// refills, drains) for every magazine in use. Returns the length written.
+int mm_format_pcp_stats(char *buf, int size);
+
 // Convert physical address to virtual address
 void *phys_to_virt(uint64_t paddr);
 
@@ -0,0 +1,58 @@
+#ifndef KERNEL_PERCPU_H
+#define KERNEL_PERCPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct task;
+struct cpu_info;
+
+// Per-CPU data block. While in the kernel the GS base of each CPU points at
+// its own block; SWAPGS exchanges it with the user value on ring 3 entry and
+// exit. syscall.asm uses the PERCPU_* offsets, keep them in sync.
+typedef struct percpu {
+    struct percpu *self;        // Lets %gs:0 be turned into a pointer
+    uint64_t kernel_rsp;        // Top of the current task's kernel stack
+    uint64_t user_rsp;          // Scratch for the SYSCALL entry path
+    uint32_t cpu_id;            // Index into the scheduler's cpus[]
+    uint32_t reserved;
+    struct task *current;       // Task running on this CPU
+    struct cpu_info *cpu;       // This CPU's scheduler state
+    uint64_t nr_syscalls;
+    uint64_t nr_irqs;
+    uint64_t nr_switches;
+} percpu_t;
+
+#define PERCPU_KERNEL_RSP  8
+#define PERCPU_USER_RSP    16
+#define PERCPU_NR_SYSCALLS 48
+
+// Read, write or increment a field of the running CPU's block with a
+// single %gs-relative instruction
+#define percpu_read(field) ({                                               \
+    __typeof__(((percpu_t *)0)->field) percpu_val__;                        \
+    __asm__ volatile("mov %%gs:%c1, %0" : "=r"(percpu_val__)                \
+                     : "i"(offsetof(percpu_t, field)));                     \
+    percpu_val__; })
+
+#define percpu_write(field, val) do {                                       \
+    __typeof__(((percpu_t *)0)->field) percpu_val__ = (val);                \
+    __asm__ volatile("mov %0, %%gs:%c1" : : "r"(percpu_val__),              \
+                     "i"(offsetof(percpu_t, field)) : "memory");            \
+} while (0)
+
+#define percpu_inc(field) \
+    __asm__ volatile("incq %%gs:%c0" : : "i"(offsetof(percpu_t, field)) : "memory")
+
+static inline percpu_t *this_cpu(void) {
+    return percpu_read(self);
+}
+
+// Point the calling CPU's GS base at the block for `cpu`. Must run before
+// anything on that CPU calls smp_processor_id().
+void percpu_init(uint32_t cpu);
+
+// Block of any CPU, for setting it up or reading its counters
+percpu_t *percpu_of(uint32_t cpu);
+
+#endif // KERNEL_PERCPU_H
@@ -2,5 +2,8 @@
 #define KERNEL_PROCFS_H
 
 void procfs_register(void);
+void procfs_add_entry(const char *name, const char *content);
+// show() fills buf (at most size bytes) and returns the length written
+void procfs_add_dynamic(const char *name, int (*show)(char *buf, int size));
 
 #endif
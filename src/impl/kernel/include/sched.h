@@ -2,6 +2,10 @@
 #define SCHED_H
 
 #include <stdint.h>
+#include "smp.h"
+#include "spinlock.h"
+#include "workqueue.h"
+#include "ktimer.h"
 
 // Task states
 #define TASK_RUNNING    0
@@ -9,10 +13,40 @@
 #define TASK_BLOCKED    2
 #define TASK_ZOMBIE     3
 
-// Maximum CPUs and tasks
-#define MAX_CPUS        64
+// Maximum tasks (MAX_CPUS comes from smp.h)
 #define MAX_TASKS       256
 
+// Kernel stack per task: 2^TASK_STACK_ORDER pages
+#define TASK_STACK_ORDER 2
+#define TASK_STACK_SIZE  (4096 << TASK_STACK_ORDER)
+
+// Ticks a priority-class task runs before it is preempted
+#define TASK_TIME_SLICE 10
+
+// Scheduling classes. Priority-class tasks always run before fair ones.
+#define SCHED_CLASS_PRIO 0      // Fixed priority, round-robin within a level
+#define SCHED_CLASS_FAIR 1      // Weighted fair share by virtual runtime
+
+// Priority levels; 0 is the highest
+#define SCHED_PRIO_LEVELS  32
+#define SCHED_PRIO_DEFAULT 16
+
+// Fair class: nice -20 (largest share) .. 19, weight 1024 at nice 0
+#define SCHED_NICE_MIN    (-20)
+#define SCHED_NICE_MAX    19
+#define SCHED_NICE_0_WEIGHT 1024
+
+// Fair class tuning, in microseconds. Every runnable task should get a turn
+// within SCHED_LATENCY_US, but no slice is shorter than the minimum
+// granularity. A waking task preempts the current one if it is behind by
+// more than the wakeup granularity (of virtual time).
+#define SCHED_LATENCY_US            20000
+#define SCHED_MIN_GRANULARITY_US    4000
+#define SCHED_WAKEUP_GRANULARITY_US 4000
+
+// Ticks between load balancing passes on a busy CPU (idle CPUs try every tick)
+#define SCHED_BALANCE_INTERVAL 10
+
 // Task structure
 typedef struct task {
     uint32_t id;
@@ -20,24 +54,72 @@ typedef struct task {
     uint32_t cpu_id;        // CPU this task is assigned to
     uint64_t time_slice;    // Remaining time slice in ticks
     uint64_t total_runtime; // Total runtime in ticks
-    void *stack;
-    void *context;
+    uint32_t priority;      // 0 .. SCHED_PRIO_LEVELS-1, lower runs first
+    uint32_t sched_class;   // SCHED_CLASS_*
+    int32_t nice;           // Fair class only
+    uint32_t weight;        // Load weight derived from nice
+    uint64_t vruntime;      // Weighted runtime (us), relative to this CPU's queue
+    int32_t heap_index;     // Slot in the fair heap while queued, else -1
+    int32_t bound_cpu;      // Pinned to this CPU, or -1 to let it migrate
+    volatile uint32_t on_cpu; // Still executing (or switching out) somewhere
+    void *stack;            // Base of the kernel stack (NULL for the boot task)
+    void *context;          // Saved stack pointer while switched out
     struct task *next;      // Next task in run queue
+    struct task *all_next;  // Every live task, for statistics
+    struct task *all_prev;
+    struct task *wait_next; // Next task on the same wait queue
+    uint32_t wait_queued;   // On a wait queue (wait.h)
+    ktimer_t sleep_timer;   // Ends a timed block (sched_block with a deadline)
+
+    // Statistics, all in microseconds of uptime
+    uint64_t exec_start;    // When the task last started running or was accounted
+    uint64_t sum_exec;      // Total time on a CPU
+    uint64_t slice_start;   // sum_exec when the task was last picked
+    uint64_t wait_start;    // When it was last queued
+    uint64_t wait_time;     // Total time spent ready but not running
+    uint64_t nr_scheduled;  // Times the task was switched in
     char name[64];
+    uint8_t fpu_state[512] __attribute__((aligned(16))); // FXSAVE area
 } task_t;
 
+// Per-CPU run queue. The priority class has one FIFO per priority plus a
+// bitmap of the non-empty ones, so enqueue and pick-next are constant time.
+// The fair class is a binary min-heap keyed on vruntime.
+typedef struct run_queue {
+    spinlock_t lock;        // Taken by other CPUs placing tasks here
+    task_t *head[SCHED_PRIO_LEVELS];
+    task_t *tail[SCHED_PRIO_LEVELS];
+    uint32_t bitmap;        // Bit n set while head[n] is non-empty
+    uint32_t nr_running;    // Queued ready tasks of both classes (not counting current)
+    task_t *fair[MAX_TASKS];
+    uint32_t nr_fair;
+    uint64_t fair_weight;   // Sum of the weights in fair[]
+    uint64_t min_vruntime;  // Monotonic floor for placing new and waking tasks
+} run_queue_t;
+
 // CPU structure
 typedef struct cpu_info {
     uint32_t id;
     uint32_t apic_id;
     uint32_t is_bsp;        // Bootstrap processor?
-    uint32_t is_smt;        // Is this a hyperthread?
-    uint32_t core_id;       // Physical core ID (for SMT detection)
+    uint32_t is_smt;        // Second or later hardware thread of its core
+    uint32_t thread_id;     // Thread index within the core
+    uint32_t core_id;       // Physical core (unique across packages)
     uint32_t package_id;    // Physical package/socket
+    uint32_t llc_id;        // CPUs with the same ID share the last-level cache
     uint32_t online;
     task_t *current;        // Currently running task
-    task_t *run_queue;      // Head of run queue
-    uint64_t idle_time;
+    run_queue_t rq;
+    task_t *idle;           // Runs when the queue is empty
+    task_t *reap;           // Exited task whose stack is freed after the switch
+    task_t *prev;           // Task being switched out; clears on_cpu once saved
+    volatile uint32_t need_resched; // Set by sched_tick, acted on at IRQ exit
+    uint64_t idle_time;     // Microseconds spent in the idle task
+    uint64_t idle_since;    // Uptime (us) the idle task last started running
+    uint32_t balance_ticks; // Ticks since the last balancing pass
+    work_t balance_work;    // The pass itself, deferred out of the tick
+    uint64_t nr_migrations_in;  // Tasks pulled onto this CPU
+    uint64_t nr_migrations_out; // Tasks pulled away by other CPUs
 } cpu_info_t;
 
 // Scheduler API
@@ -45,11 +127,60 @@ void sched_init(void);
 int sched_cpu_count(void);
 cpu_info_t *sched_get_cpu(int id);
 task_t *sched_create_task(const char *name, void (*entry)(void));
+task_t *sched_create_task_prio(const char *name, void (*entry)(void), uint32_t priority);
 void sched_yield(void);
+
+// Kernel threads run fn(arg) and exit when it returns. kthread_create
+// makes a fair-class thread placed like any task; kthread_create_on_cpu
+// pins a priority-class thread to one online CPU (per-CPU service threads).
+task_t *kthread_create(const char *name, void (*fn)(void *), void *arg);
+task_t *kthread_create_on_cpu(const char *name, void (*fn)(void *), void *arg, int cpu, uint32_t priority);
+
+// Move a fair-class task to a new nice value (clamped to the valid range)
+void sched_set_nice(task_t *t, int nice);
+
+// Make a TASK_BLOCKED task runnable again on its CPU. A task that slept is
+// placed near the front of the fair queue and may preempt the running one.
+void sched_wake_task(task_t *t);
+
+// Blocking. The caller sets TASK_BLOCKED on itself (after making sure a
+// waker can find it) and calls sched_block, which returns once the task
+// is woken or, with a nonzero deadline, that uptime (us) has passed.
+// sched_cancel_block puts the task back to TASK_RUNNING afterwards, or
+// instead of blocking when the wait turned out to be unnecessary.
+// Contexts that cannot block (early boot, idle task, IRQs off) fall back
+// to halting until the next interrupt.
+int sched_can_block(void);
+void sched_block(uint64_t deadline_us);
+void sched_cancel_block(void);
+
+// Block the calling task for at least `us` microseconds
+void sched_sleep_us(uint64_t us);
+
 void sched_schedule(void);
 void sched_tick(void);
 
+// Called on the way out of the timer interrupt; switches tasks if the
+// current slice has expired.
+void sched_preempt(void);
+
+// Terminate the calling task
+void sched_exit(void);
+
+// Idle loop (pre-zeroes free pages, then halts)
+int sched_idle_work(void);
+void sched_idle(void);
+
 // SMT-aware scheduling
 void sched_set_smt_aware(int enabled);
 
+// AP bring-up: allocate the idle stack of a CPU (returns its top, or 0),
+// then mark the CPU online from the AP itself once it can take interrupts.
+uint64_t sched_prepare_cpu(int id);
+void sched_cpu_online(int id);
+
+// /proc/cpuinfo and /proc/sched (per-task runtime and wait statistics)
+int sched_format_cpuinfo(char *buf, int size);
+int sched_format_tasks(char *buf, int size);
+
 #endif // SCHED_H
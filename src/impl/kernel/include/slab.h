@@ -0,0 +1,34 @@
+#ifndef KERNEL_SLAB_H
+#define KERNEL_SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Object cache. Objects of one type are carved out of slabs (naturally
+// aligned blocks from the PFA); each slab sits on the cache's partial,
+// full or free list depending on how many of its objects are in use.
+typedef struct kmem_cache kmem_cache_t;
+
+// Initialize the kmalloc size classes. Requires mm_init.
+void slab_init(void);
+
+// Create a cache for objects of the given size. align may be 0 for the
+// default 16-byte alignment. ctor, if set, runs once per object when its
+// slab is created; objects must be returned to that state before freeing.
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *obj));
+
+// Allocate/free one object. Objects must go back to the cache they came from.
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+// Release the cache's empty slabs back to the PFA
+void kmem_cache_shrink(kmem_cache_t *cache);
+
+// General purpose heap. Requests up to 1 KiB come from size-class caches,
+// larger ones get whole pages from the buddy allocator.
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void kfree(void *ptr);
+
+#endif // KERNEL_SLAB_H
@@ -0,0 +1,38 @@
+#ifndef KERNEL_SMP_H
+#define KERNEL_SMP_H
+
+#include <stdint.h>
+#include "percpu.h"
+
+// Maximum CPUs the kernel tracks
+#define MAX_CPUS        64
+
+// Physical page the AP real-mode trampoline is copied to (below 1 MiB and
+// inside the region mm_init keeps reserved). Keep in sync with ap_trampoline.asm.
+#define AP_TRAMPOLINE_ADDR 0x8000
+
+// Inter-processor interrupt vectors
+#define IPI_RESCHED_VECTOR 0xF0 // Target CPU should check need_resched
+#define IPI_TLB_VECTOR     0xF2 // Target CPU should flush the published TLB entries
+
+// Index of the executing CPU in the scheduler's cpus[] table
+static inline uint32_t smp_processor_id(void) {
+    return percpu_read(cpu_id);
+}
+
+// Start every application processor listed in the MADT. Requires
+// acpi_init and sched_init.
+void smp_init(void);
+
+// Number of CPUs running the scheduler
+int smp_online_cpus(void);
+
+// Ask another CPU to reschedule
+void smp_send_resched(uint32_t cpu);
+
+// Invalidate pages (or everything, if `full`) in the TLBs of every other
+// online CPU and wait until all have done so. The caller has already
+// flushed its own. Returns 1 if any other CPU was involved.
+int smp_tlb_shootdown(const uint64_t *addrs, uint32_t count, int full);
+
+#endif // KERNEL_SMP_H
@@ -0,0 +1,52 @@
+#ifndef KERNEL_SPINLOCK_H
+#define KERNEL_SPINLOCK_H
+
+#include <stdint.h>
+
+// Test-and-test-and-set spinlock. Use the _irqsave variants for any lock
+// that is also taken from interrupt context.
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+// Save RFLAGS and disable interrupts on this CPU
+static inline uint64_t local_irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Re-enable interrupts only if they were enabled when saved
+static inline void local_irq_restore(uint64_t flags) {
+    if (flags & (1 << 9)) __asm__ volatile("sti" : : : "memory");
+}
+
+static inline void spin_lock(spinlock_t *lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (lock->locked) __asm__ volatile("pause");
+    }
+}
+
+// Take the lock if it is free; returns 1 if taken
+static inline int spin_trylock(spinlock_t *lock) {
+    return !lock->locked && !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t *lock) {
+    uint64_t flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
+
+#endif // KERNEL_SPINLOCK_H
@@ -12,8 +12,61 @@ uint64_t timer_get_uptime_ms(void);
 // Get system uptime in ticks
 uint64_t timer_get_ticks(void);
 
-// Sleep for specified milliseconds (busy-wait for now, will use scheduler later)
+// Get system uptime in nanoseconds / microseconds. With the TSC clock
+// source this has cycle resolution, with the HPET that of its counter;
+// otherwise it advances by PIT ticks.
+uint64_t timer_get_uptime_ns(void);
+uint64_t timer_get_uptime_us(void);
+
+// Calibrate the TSC against the HPET (or the PIT without one) and make it
+// the clock source, if it runs at a constant rate; otherwise use a 64-bit
+// HPET counter. Requires pit_init and, to use the HPET, hpet_init; the PIT
+// count stays the fallback.
+void timer_clocksource_init(void);
+
+// Raw TSC reads for measuring short intervals, and their conversion
+// (valid once the clock source is calibrated)
+uint64_t timer_read_cycles(void);
+uint64_t timer_cycles_to_ns(uint64_t cycles);
+
+// Sleep for specified milliseconds / microseconds. A task blocks and other
+// tasks run meanwhile; before the scheduler is up the CPU halts until a
+// one-shot wakeup fires, and with interrupts disabled this degrades to a spin.
 void timer_sleep_ms(uint32_t ms);
+void timer_sleep_us(uint64_t us);
+
+// Spin for `us` microseconds without relying on interrupts
+void timer_udelay(uint32_t us);
+
+// Poll until cond is true, at most timeout_us of uptime, checking every
+// poll_us and sleeping (or spinning, where sleeping is impossible) in
+// between. Evaluates to nonzero if cond became true. Unlike a counted
+// loop, the limit does not depend on CPU speed or code generation.
+#define timer_poll_until(cond, timeout_us, poll_us) ({                      \
+    uint64_t __deadline = timer_get_uptime_us() + (timeout_us);             \
+    int __done;                                                             \
+    while (!(__done = !!(cond)) && timer_get_uptime_us() < __deadline) {    \
+        timer_sleep_us(poll_us);                                            \
+    }                                                                       \
+    __done;                                                                 \
+})
+
+// Calibrate the LAPIC timer against the HPET or PIT and move the BSP's tick
+// to its LAPIC timer: one-shot with a TSC or HPET clock source, periodic
+// otherwise. Requires lapic_init; returns -1 if the timer is unusable and
+// the PIT tick stays. APs call timer_clockevents_init_cpu as they come up
+// and check their own timer rate against the BSP's.
+int timer_clockevents_init(void);
+void timer_clockevents_init_cpu(void);
+
+// Make sure the calling CPU takes a timer interrupt by `deadline_us`
+// (uptime). Earlier requests win; the request is dropped once it fires.
+void timer_request_wakeup(uint64_t deadline_us);
+
+// Stop/restart the periodic scheduler tick on the calling CPU when it
+// enters/leaves idle. Pending sleep wakeups stay armed. IRQs must be off.
+void timer_tick_stop(void);
+void timer_tick_start(void);
 
 // Get ticks per second
 uint32_t timer_get_frequency(void);
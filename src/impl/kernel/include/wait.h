@@ -0,0 +1,53 @@
+#ifndef KERNEL_WAIT_H
+#define KERNEL_WAIT_H
+
+#include <stdint.h>
+#include "spinlock.h"
+#include "sched.h"
+#include "timer.h"
+
+// Tasks waiting for a condition that some other code (often an interrupt
+// handler) makes true and then announces with wake_up. A task waits on at
+// most one queue at a time; the queue links tasks through task_t.
+typedef struct wait_queue {
+    spinlock_t lock;
+    task_t *head;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL }
+
+void wait_queue_init(wait_queue_t *wq);
+
+// Wake every task waiting on wq. Safe from interrupt handlers.
+void wake_up(wait_queue_t *wq);
+
+// Building blocks of wait_event: queue the calling task and mark it
+// blocked, then (after sleeping or not) take it off again
+void wait_prepare(wait_queue_t *wq);
+void wait_finish(wait_queue_t *wq);
+
+// Block until cond is true. cond is re-checked after queueing, so a
+// wake_up between the first check and going to sleep is not lost.
+#define wait_event(wq, cond)                                                \
+    do {                                                                    \
+        while (!(cond)) {                                                   \
+            wait_prepare(wq);                                               \
+            if (!(cond)) sched_block(0);                                    \
+            wait_finish(wq);                                                \
+        }                                                                   \
+    } while (0)
+
+// As wait_event, but give up after timeout_us. Evaluates to nonzero if
+// cond became true.
+#define wait_event_timeout(wq, cond, timeout_us) ({                         \
+    uint64_t __deadline = timer_get_uptime_us() + (timeout_us);             \
+    int __done;                                                             \
+    while (!(__done = !!(cond)) && timer_get_uptime_us() < __deadline) {    \
+        wait_prepare(wq);                                                   \
+        if (!(cond)) sched_block(__deadline);                               \
+        wait_finish(wq);                                                    \
+    }                                                                       \
+    __done;                                                                 \
+})
+
+#endif // KERNEL_WAIT_H
@@ -0,0 +1,40 @@
+#ifndef KERNEL_WORKQUEUE_H
+#define KERNEL_WORKQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Deferred work. Interrupt handlers do the minimum with interrupts off and
+// queue the rest as a work item; a per-CPU worker thread runs everything
+// queued on its CPU in one batch, in thread context with interrupts on.
+typedef struct work {
+    void (*fn)(struct work *work);
+    struct work *next;
+    volatile uint32_t pending;  // Queued and not yet started
+} work_t;
+
+#define WORK_INIT(f) { (f), NULL, 0 }
+
+// Priority of the worker threads: ahead of every fair task and most
+// priority-class ones, like the bottom half of an interrupt
+#define WORKQUEUE_PRIO 2
+
+static inline void work_init(work_t *work, void (*fn)(work_t *)) {
+    work->fn = fn;
+    work->next = NULL;
+    work->pending = 0;
+}
+
+// Start a worker thread on every online CPU. Requires sched_init/smp_init.
+void workqueue_init(void);
+
+// Queue work on the calling CPU / on `cpu`. Safe from interrupt handlers.
+// Returns 1 if queued, 0 if it was already pending (it will run once),
+// or -1 if there is no worker yet and the caller must do the work itself.
+int schedule_work(work_t *work);
+int schedule_work_on(int cpu, work_t *work);
+
+// /proc/workqueues
+int workqueue_format_stats(char *buf, int size);
+
+#endif // KERNEL_WORKQUEUE_H
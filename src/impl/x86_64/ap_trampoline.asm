@@ -0,0 +1,97 @@
+; ap_trampoline.asm - real-mode entry point for application processors
+;
+; smp.c copies everything between ap_trampoline_start and ap_trampoline_end
+; to AP_TRAMPOLINE_ADDR and sends the STARTUP IPI there. The code runs from
+; that copy, so absolute addresses are taken relative to the load address.
+; smp.c fills in the ap_tramp_* parameters in the copy before each AP.
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_tramp_cr3
+global ap_tramp_efer
+global ap_tramp_stack
+global ap_tramp_entry
+global ap_tramp_cpu
+
+%define AP_TRAMPOLINE_ADDR 0x8000           ; Keep in sync with smp.h
+%define TRAMP(x) (AP_TRAMPOLINE_ADDR + (x) - ap_trampoline_start)
+
+section .text
+bits 16
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    lgdt [TRAMP(tramp_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1                               ; PE
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(ap_pm32)
+
+bits 32
+ap_pm32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; PAE, plus OSFXSR/OSXMMEXCPT as boot.asm sets up SSE on the BSP
+    mov eax, cr4
+    or eax, (1 << 5) | (3 << 9)
+    mov cr4, eax
+
+    ; The BSP's page tables (the PML4 lives below 4 GiB)
+    mov eax, [TRAMP(ap_tramp_cr3)]
+    mov cr3, eax
+
+    ; Same EFER as the BSP, which includes LME
+    mov ecx, 0xC0000080
+    mov eax, [TRAMP(ap_tramp_efer)]
+    mov edx, [TRAMP(ap_tramp_efer) + 4]
+    wrmsr
+
+    mov eax, cr0
+    and eax, ~(1 << 2)                      ; Clear EM
+    or eax, (1 << 31) | (1 << 1)            ; PG, MP
+    mov cr0, eax
+    jmp 0x18:TRAMP(ap_lm64)
+
+bits 64
+ap_lm64:
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov fs, ax
+    mov gs, ax
+
+    mov rsp, [TRAMP(ap_tramp_stack)]
+    mov edi, [TRAMP(ap_tramp_cpu)]
+    mov rax, [TRAMP(ap_tramp_entry)]
+    call rax                                ; ap_main(cpu), does not return
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+align 16
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF                   ; 0x08: 32-bit code
+    dq 0x00CF92000000FFFF                   ; 0x10: data
+    dq 0x00AF9A000000FFFF                   ; 0x18: 64-bit code
+tramp_gdt_ptr:
+    dw tramp_gdt_ptr - tramp_gdt - 1
+    dd TRAMP(tramp_gdt)
+
+align 8
+ap_tramp_cr3:   dq 0
+ap_tramp_efer:  dq 0
+ap_tramp_stack: dq 0
+ap_tramp_entry: dq 0
+ap_tramp_cpu:   dq 0
+ap_trampoline_end:
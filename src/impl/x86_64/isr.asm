@@ -1,10 +1,23 @@
 global isr_default_handler
 global isr_irq0
 global isr_irq1
+global isr_ipi_resched
+global isr_ipi_tlb
+global isr_spurious
+global isr_lapic_timer
 
 section .text
 bits 64
 
+; Interrupts taken in ring 3 arrive with the user GS base loaded. Used on
+; entry and again just before iretq, when the saved CS is at [rsp + 8].
+%macro swapgs_if_user 0
+    test qword [rsp + 8], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
 isr_default_handler:
     cli
     hlt
@@ -12,6 +25,7 @@ isr_default_handler:
 ; IRQ handler stub for IRQ0 (timer)
 isr_irq0:
     cli
+    swapgs_if_user
     push rbp
     push rax
     push rbx
@@ -26,6 +40,10 @@ isr_irq0:
     mov rdi, 0
     extern irq_handler
     call irq_handler
+    ; irq_handler has sent EOI; switch tasks if the slice ran out.
+    ; We resume here when this task is next scheduled.
+    extern sched_preempt
+    call sched_preempt
     pop r11
     pop r10
     pop r9
@@ -37,15 +55,13 @@ isr_irq0:
     pop rbx
     pop rax
     pop rbp
-    ; send EOI to PIC
-    mov al, 0x20
-    out 0x20, al
-    sti
+    swapgs_if_user
     iretq
 
 ; IRQ handler stub for IRQ1 (keyboard)
 isr_irq1:
     cli
+    swapgs_if_user
     push rbp
     push rax
     push rbx
@@ -71,10 +87,101 @@ isr_irq1:
     pop rbx
     pop rax
     pop rbp
-    ; send EOI to PIC (both if slave)
-    mov al, 0x20
-    out 0xA0, al
-    mov al, 0x20
-    out 0x20, al
-    sti
+    swapgs_if_user
+    iretq
+
+; IPI stub: another CPU queued work for this one
+isr_ipi_resched:
+    swapgs_if_user
+    push rbp
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    extern smp_ipi_resched
+    call smp_ipi_resched
+    call sched_preempt
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    pop rbp
+    swapgs_if_user
+    iretq
+
+; IPI stub: invalidate the TLB entries another CPU changed
+isr_ipi_tlb:
+    swapgs_if_user
+    push rbp
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    extern smp_ipi_tlb
+    call smp_ipi_tlb
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    pop rbp
+    swapgs_if_user
+    iretq
+
+; Local APIC timer: per-CPU clock event (scheduler tick and sleep wakeups)
+isr_lapic_timer:
+    swapgs_if_user
+    push rbp
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    extern timer_event_interrupt
+    call timer_event_interrupt
+    call sched_preempt
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    pop rbp
+    swapgs_if_user
+    iretq
+
+; Local APIC spurious interrupt: no EOI, nothing to do
+isr_spurious:
     iretq
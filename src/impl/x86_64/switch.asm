@@ -0,0 +1,43 @@
+; switch.asm - kernel thread context switch
+
+global context_switch
+global task_entry_trampoline
+extern sched_task_start
+extern sched_exit
+
+section .text
+bits 64
+
+; void context_switch(uint64_t *prev_rsp, uint64_t next_rsp,
+;                     void *prev_fpu, void *next_fpu)
+; Saves the FPU/SSE state and callee-saved registers of the current thread,
+; stores its stack pointer in *prev_rsp and resumes the thread whose saved
+; stack pointer is next_rsp. Called with interrupts disabled.
+context_switch:
+    fxsave [rdx]
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    fxrstor [rcx]
+    ret
+
+; First code a new thread runs: context_switch returns here with the entry
+; point in r12 and its argument in r13.
+task_entry_trampoline:
+    call sched_task_start   ; Finish the switch and enable interrupts
+    mov rdi, r13
+    call r12
+    call sched_exit         ; Does not return
+    hlt
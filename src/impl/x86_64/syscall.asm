@@ -16,14 +16,23 @@ extern syscall_handler
 ; R8  = arg5
 ; R9  = arg6
 
+; Per-CPU block offsets (percpu.h)
+%define PERCPU_KERNEL_RSP  8
+%define PERCPU_USER_RSP    16
+%define PERCPU_NR_SYSCALLS 48
+
 syscall_entry:
-    ; Save user stack pointer
-    mov r12, rsp
-    
-    ; Switch to kernel stack (use a simple approach for now)
-    ; In a real implementation, we'd use the TSS or per-CPU data
-    ; For now, we'll use a static kernel stack
-    mov rsp, kernel_syscall_stack_top
+    ; SYSCALL comes from ring 3 with the user GS base loaded; SWAPGS makes
+    ; %gs the per-CPU block. SFMASK keeps interrupts off until we are on
+    ; this CPU's kernel stack.
+    swapgs
+    mov [gs:PERCPU_USER_RSP], rsp
+    mov rsp, [gs:PERCPU_KERNEL_RSP]
+
+    ; Keep the user stack pointer on the kernel stack; the per-CPU scratch
+    ; slot is reused by the next syscall on this CPU
+    push qword [gs:PERCPU_USER_RSP]
+    inc qword [gs:PERCPU_NR_SYSCALLS]
     
     ; Save callee-saved registers
     push rbx
@@ -36,6 +45,11 @@ syscall_entry:
     ; Save RCX (return address) and R11 (flags)
     push rcx
     push r11
+    sub rsp, 8      ; Keep the stack 16-byte aligned for the call
+
+    ; Everything needed to return is on this task's own stack now, so the
+    ; handler can take interrupts and block (switching tasks) safely
+    sti
     
     ; Set up arguments for syscall_handler
     ; syscall_handler(num, arg1, arg2, arg3, arg4, arg5)
@@ -53,8 +67,10 @@ syscall_entry:
     ; Call the C handler
     call syscall_handler
     ; Return value is in RAX
+    cli
     
     ; Restore saved registers
+    add rsp, 8
     pop r11
     pop rcx
     pop r15
@@ -64,15 +80,12 @@ syscall_entry:
     pop rbp
     pop rbx
     
-    ; Restore user stack
-    mov rsp, r12
+    ; Restore user stack and GS base
+    pop rsp
+    swapgs
     
     ; Return to userspace
     ; SYSRET expects:
     ; RCX = return address
     ; R11 = saved RFLAGS
     o64 sysret
-
-section .bss
-    resb 4096
-kernel_syscall_stack_top: